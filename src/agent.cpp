@@ -1,5 +1,12 @@
 #include "agent.hpp"
+#include "alloc_stats.hpp"
+#include "file_cache.hpp"
+#include "markdown.hpp"
+#include "output.hpp"
+#include "patch.hpp"
+#include "session_io.hpp"
 #include "tools.hpp"
+#include "trace.hpp"
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
@@ -7,9 +14,15 @@
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/use_awaitable.hpp>
 #include <boost/json/src.hpp> // Include this once in the project if needed, or link
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <filesystem>
+#include <format>
 #include <fstream>
 #include <iostream>
+#include <ranges>
+#include <unistd.h>
 
 #include "replxx.hxx"
 
@@ -24,20 +37,45 @@ const std::string GREEN = "\033[32m";
 const std::string YELLOW = "\033[33m";
 const std::string RED = "\033[31m";
 
-std::string render_markdown(const std::string &text) {
-  // A simple regex replacement for **bold** could be done here.
-  // To avoid complex regex in C++, we do a simple string find/replace
-  std::string res = text;
-  size_t pos = 0;
-  while ((pos = res.find("**", pos)) != std::string::npos) {
-    size_t end = res.find("**", pos + 2);
-    if (end == std::string::npos)
-      break;
-    std::string inner = res.substr(pos + 2, end - pos - 2);
-    res.replace(pos, end - pos + 2, BOLD + inner + RESET);
-    pos += inner.length() + BOLD.length() + RESET.length();
+// The workspace's state directory. It is created by whatever first saves a
+// file there; see tools::create_state_dir().
+std::filesystem::path state_dir() {
+  return std::filesystem::current_path() / tools::state_dir_name;
+}
+
+// Records the heap allocations made during one turn into the session stats.
+struct TurnAllocations {
+  SessionStats &stats;
+  std::size_t start = alloc_stats::allocations();
+
+  ~TurnAllocations() {
+    stats.last_turn_allocations = alloc_stats::allocations() - start;
+    stats.turn_allocations += stats.last_turn_allocations;
   }
-  return res;
+};
+
+// Display form of a tool's first argument, capped at 50 characters. Only the
+// displayed prefix is escaped: the first argument of `write` can be a whole
+// file.
+std::string preview_args(const boost::json::object &args) {
+  if (args.empty())
+    return {};
+  const auto &first = args.begin()->value();
+  std::string preview;
+  if (first.is_string()) {
+    const auto &str = first.get_string();
+    append_json_string(preview,
+                       {str.data(), std::min<std::size_t>(str.size(), 50)});
+  } else if (first.is_object()) {
+    preview = "{...}";
+  } else if (first.is_array()) {
+    preview = "[...]";
+  } else {
+    preview = boost::json::serialize(first);
+  }
+  if (preview.size() > 50)
+    preview.resize(50);
+  return preview;
 }
 
 std::string separator() {
@@ -48,107 +86,75 @@ std::string separator() {
   return s;
 }
 
-boost::json::object Agent::build_anthropic_payload() {
-  boost::json::object payload;
-  payload["model"] = current_model_;
-  payload["max_tokens"] = 8192;
-  payload["system"] = system_prompt_;
-  payload["tools"] = tools::get_tools_schema();
-  boost::json::array msgs;
-  for (const auto &m : messages_) {
-    msgs.push_back(m);
-  }
-  payload["messages"] = msgs;
-  return payload;
+std::string Agent::build_anthropic_payload(const std::string &model,
+                                           bool stream) {
+  static const std::string tools_json =
+      boost::json::serialize(tools::get_tools_schema());
+
+  std::string body;
+  body.reserve(last_payload_size_ + last_payload_size_ / 4);
+  body += R"({"model":)";
+  append_json_string(body, model);
+  body += R"(,"max_tokens":8192,"system":)";
+  append_json_string(body, system_prompt_);
+  body += R"(,"tools":)";
+  body += tools_json;
+  body += R"(,"messages":)";
+  // Breakpoints at the end of this branch's previous request, so the prefix
+  // it shares with its forks is read from the cache, and at the new end.
+  std::size_t breakpoints[2];
+  std::size_t n_breakpoints = 0;
+  if (cache_mark_ > 0 && cache_mark_ < messages_.size())
+    breakpoints[n_breakpoints++] = cache_mark_ - 1;
+  if (!messages_.empty())
+    breakpoints[n_breakpoints++] = messages_.size() - 1;
+  write_anthropic_messages(body, messages_.messages(),
+                           {breakpoints, n_breakpoints});
+  if (stream)
+    body += R"(,"stream":true)";
+  body += '}';
+  last_payload_size_ = body.size();
+  return body;
 }
 
-boost::json::object Agent::build_openai_payload() {
-  boost::json::object payload;
-  payload["model"] = current_model_;
-
-  // Tools schema translation
-  boost::json::array openai_tools;
-  for (const auto &anthropic_tool_val : tools::get_tools_schema()) {
-    const auto &anthropic_tool = anthropic_tool_val.as_object();
-    boost::json::object func;
-    func["name"] = anthropic_tool.at("name");
-    func["description"] = anthropic_tool.at("description");
-    func["parameters"] =
-        anthropic_tool.at("input_schema"); // close enough for OpenAI/Gemini
-
-    boost::json::object tool;
-    tool["type"] = "function";
-    tool["function"] = func;
-    openai_tools.push_back(tool);
-  }
-  payload["tools"] = openai_tools;
-
-  // Messages translation
-  boost::json::array msgs;
-  msgs.push_back({{"role", "system"}, {"content", system_prompt_}});
-
-  for (const auto &m_val : messages_) {
-    const auto &m = m_val.as_object();
-    std::string role = m.at("role").as_string().c_str();
-
-    if (role == "user") {
-      const auto &content = m.at("content");
-      if (content.is_string()) {
-        msgs.push_back({{"role", "user"}, {"content", content.as_string()}});
-      } else if (content.is_array()) {
-        // Tool results
-        for (const auto &item_val : content.as_array()) {
-          const auto &item = item_val.as_object();
-          if (item.at("type").as_string() == "tool_result") {
-            msgs.push_back({{"role", "tool"},
-                            {"tool_call_id", item.at("tool_use_id")},
-                            {"content", item.at("content")}});
-          }
-        }
-      }
-    } else if (role == "assistant") {
-      const auto &content = m.at("content");
-      if (content.is_array()) {
-        std::string text_content;
-        boost::json::array tool_calls;
-        for (const auto &block_val : content.as_array()) {
-          const auto &block = block_val.as_object();
-          std::string type = block.at("type").as_string().c_str();
-          if (type == "text") {
-            text_content += block.at("text").as_string().c_str();
-          } else if (type == "tool_use") {
-            boost::json::object func;
-            func["name"] = block.at("name");
-            func["arguments"] = boost::json::serialize(block.at("input"));
-            boost::json::object tc;
-            tc["id"] = block.at("id");
-            tc["type"] = "function";
-            tc["function"] = func;
-            tool_calls.push_back(tc);
-          }
-        }
-        boost::json::object asst_msg;
-        asst_msg["role"] = "assistant";
-        if (!text_content.empty())
-          asst_msg["content"] = text_content;
-        if (!tool_calls.empty())
-          asst_msg["tool_calls"] = tool_calls;
-        msgs.push_back(asst_msg);
-      } else if (content.is_string()) {
-        msgs.push_back(
-            {{"role", "assistant"}, {"content", content.as_string()}});
-      }
+std::string Agent::build_openai_payload(const std::string &model,
+                                        bool stream) {
+  // Tools schema translation, done once
+  static const std::string tools_json = [] {
+    boost::json::array openai_tools;
+    for (const auto &anthropic_tool_val : tools::get_tools_schema()) {
+      const auto &anthropic_tool = anthropic_tool_val.as_object();
+      boost::json::object func;
+      func["name"] = anthropic_tool.at("name");
+      func["description"] = anthropic_tool.at("description");
+      func["parameters"] =
+          anthropic_tool.at("input_schema"); // close enough for OpenAI/Gemini
+
+      boost::json::object tool;
+      tool["type"] = "function";
+      tool["function"] = func;
+      openai_tools.push_back(tool);
     }
-  }
-  payload["messages"] = msgs;
-  return payload;
+    return boost::json::serialize(openai_tools);
+  }();
+
+  std::string body;
+  body.reserve(last_payload_size_ + last_payload_size_ / 4);
+  body += R"({"model":)";
+  append_json_string(body, model);
+  body += R"(,"tools":)";
+  body += tools_json;
+  body += R"(,"messages":)";
+  write_openai_messages(body, system_prompt_, messages_.messages());
+  if (stream)
+    body += R"(,"stream":true)";
+  body += '}';
+  last_payload_size_ = body.size();
+  return body;
 }
 
-boost::json::object
-Agent::normalize_openai_response(const boost::json::object &raw_resp) {
-  // Translate OpenAI response to Anthropic structure
-  boost::json::object anthropic_content;
-  boost::json::array content_blocks;
+Message Agent::normalize_openai_response(const boost::json::object &raw_resp) {
+  Message reply{Role::assistant, {}};
 
   if (raw_resp.contains("choices") && raw_resp.at("choices").is_array() &&
       !raw_resp.at("choices").as_array().empty()) {
@@ -159,10 +165,8 @@ Agent::normalize_openai_response(const boost::json::object &raw_resp) {
                               .as_object();
 
     if (message.contains("content") && message.at("content").is_string()) {
-      boost::json::object text_block;
-      text_block["type"] = "text";
-      text_block["text"] = message.at("content").as_string();
-      content_blocks.push_back(text_block);
+      const auto &text = message.at("content").as_string();
+      reply.content.push_back(TextBlock{std::string(text.data(), text.size())});
     }
 
     if (message.contains("tool_calls") && message.at("tool_calls").is_array()) {
@@ -170,40 +174,149 @@ Agent::normalize_openai_response(const boost::json::object &raw_resp) {
         const auto &tc = tc_val.as_object();
         if (tc.at("type").as_string() == "function") {
           const auto &func = tc.at("function").as_object();
-          boost::json::object tool_use_block;
-          tool_use_block["type"] = "tool_use";
-          tool_use_block["id"] = tc.at("id");
-          tool_use_block["name"] = func.at("name");
+          const auto &id = tc.at("id").as_string();
+          const auto &name = func.at("name").as_string();
+          ToolUseBlock use{interner_.intern({id.data(), id.size()}),
+                           interner_.intern({name.data(), name.size()}),
+                           boost::json::object(history_sp_)};
           // parse arguments string back to json object
-          tool_use_block["input"] =
-              boost::json::parse(func.at("arguments").as_string().c_str())
-                  .as_object();
-          content_blocks.push_back(tool_use_block);
+          boost::system::error_code ec;
+          auto args = boost::json::parse(func.at("arguments").as_string(), ec,
+                                         history_sp_);
+          if (!ec && args.is_object())
+            use.input = std::move(args.as_object());
+          reply.content.push_back(std::move(use));
         }
       }
     }
   }
 
-  anthropic_content["content"] = content_blocks;
-  return anthropic_content;
+  return reply;
 }
 
 Agent::Agent(AgentConfig config)
     : agent_config_(std::move(config)),
-      current_model_(agent_config_.initial_model) {}
+      current_model_(agent_config_.initial_model),
+      history_sp_(
+          boost::json::make_shared_resource<boost::json::monotonic_resource>()),
+      repo_map_(std::filesystem::current_path(), state_dir() / "repomap"),
+      session_index_(agent_config_.session_index_path),
+      checkpoints_(state_dir() / "checkpoints" / std::to_string(::getpid())) {
+  // Leave most of a tight budget to the conversation itself.
+  if (agent_config_.memory_limit)
+    tools::file_cache().set_capacity(std::min<std::size_t>(
+        64 * 1024 * 1024, agent_config_.memory_limit / 4));
+  refresh_system_prompt();
+}
+
+void Agent::refresh_system_prompt() {
+  system_prompt_ = "Concise coding assistant.";
+  if (agent_config_.repo_map_tokens == 0)
+    return;
+  trace::Span span("repo_map", trace::Track::agent);
+  repo_map_.update();
+  if (std::string map = repo_map_.render(agent_config_.repo_map_tokens);
+      !map.empty())
+    system_prompt_ += "\n\n" + map;
+}
+
+// Tool results in the last `hot_messages` messages stay on the heap; older
+// ones of at least `spill_min_bytes` go to the spill file.
+constexpr std::size_t hot_messages = 16;
+constexpr std::size_t spill_min_bytes = 16 * 1024;
+
+void Agent::spill_cold_results() {
+  trace::Span span("spill", trace::Track::agent);
+  messages_.spill_cold(spill_, hot_messages, spill_min_bytes);
+}
+
+MemoryUsage Agent::memory_usage(bool exact_history) const {
+  MemoryUsage usage;
+  if (exact_history) {
+    std::unordered_set<const Message *> seen;
+    usage.history = messages_.heap_bytes(seen);
+    for (const auto &[name, branch] : parked_branches_)
+      usage.history += branch.history.heap_bytes(seen);
+  } else {
+    usage.history = messages_.bytes();
+    for (const auto &[name, branch] : parked_branches_)
+      usage.history += branch.history.bytes();
+  }
+  usage.file_cache = tools::file_cache().stats().bytes;
+  usage.session_index = session_index_.memory_bytes();
+  usage.repo_map = repo_map_.memory_bytes() + system_prompt_.capacity();
+  usage.request_buffer = last_payload_size_;
+  usage.heap_in_use = alloc_stats::bytes_in_use();
+  usage.resident = alloc_stats::resident_bytes();
+  usage.spilled = spill_.bytes();
+  return usage;
+}
+
+std::size_t Agent::enforce_memory_limit() {
+  std::size_t limit = agent_config_.memory_limit;
+  auto excess = [&] {
+    // The allocator's figure, when there is one, needs no accounting walk.
+    std::size_t footprint = alloc_stats::bytes_in_use();
+    if (footprint == 0)
+      footprint = memory_usage(false).footprint();
+    return footprint > limit ? footprint - limit : 0;
+  };
+  std::size_t over = limit ? excess() : 0;
+  if (over == 0)
+    return 0;
+  trace::Span span("enforce_memory", trace::Track::agent);
+
+  // Caches first; both refill on demand.
+  std::size_t cached = tools::file_cache().stats().bytes;
+  tools::file_cache().shrink_to(cached > over ? cached - over : 0);
+  session_index_.unload();
+  if ((over = excess()) == 0)
+    return 0;
+
+  // Then every tool result the model is not working with right now, in
+  // parked branches too.
+  constexpr std::size_t min_bytes = 1024;
+  messages_.spill_cold(spill_, 2, min_bytes);
+  for (auto &[name, branch] : parked_branches_)
+    branch.history.spill_cold(spill_, 0, min_bytes);
+  spill_.drop_pages();
+  return excess();
+}
+
+void Agent::reset_history() {
+  replace_history(
+      History{}, Interner{},
+      boost::json::make_shared_resource<boost::json::monotonic_resource>());
+}
 
-LLMConfig Agent::get_llm_config() const {
+void Agent::replace_history(History history, Interner interner,
+                            boost::json::storage_ptr sp) {
+  // The old messages go first, while the interner they view is still alive.
+  // Values still referencing the old arena keep it alive until they go.
+  messages_ = std::move(history);
+  cache_mark_ = 0;
+  memory_warned_ = false;
+  // Parked branches still point into the interner, and keep the system
+  // prompt their cached prefixes were built with.
+  if (parked_branches_.empty()) {
+    interner_ = std::move(interner);
+    refresh_system_prompt();
+  }
+  history_sp_ = std::move(sp);
+}
+
+LLMConfig Agent::get_llm_config(const std::string &model) const {
   LLMConfig config;
-  config.model = current_model_;
+  config.model = model;
 
   // Determine API based on model name
-  if (current_model_.find('/') != std::string::npos) {
+  if (model.find('/') != std::string::npos) {
     config.api_key = agent_config_.openrouter_key;
     config.api_url = "https://openrouter.ai/api/v1/messages";
     config.is_anthropic_format = true;
     config.is_openai_format = false;
-  } else if (current_model_.find("gemini") != std::string::npos ||
-             current_model_.find("learnlm") != std::string::npos) {
+  } else if (model.find("gemini") != std::string::npos ||
+             model.find("learnlm") != std::string::npos) {
     config.api_key = agent_config_.gemini_key;
     config.api_url = "https://generativelanguage.googleapis.com/v1beta/openai/"
                      "chat/completions";
@@ -218,6 +331,41 @@ LLMConfig Agent::get_llm_config() const {
   return config;
 }
 
+RouteDecision
+Agent::route_turn(const std::vector<ToolOutcome> &pending) const {
+  if (agent_config_.fast_model.empty() || !routing_enabled_)
+    return {false, "routing off"};
+  if (pending.empty())
+    return {false, "planning"};
+  if (escalated_)
+    return {false, "escalated"};
+
+  // Only turns that digest successful, low-information tool results are
+  // mechanical enough for the fast model: acknowledging an edit or write,
+  // or summarizing a short command output such as a passing test run.
+  std::size_t total_bytes = 0;
+  bool all_mutations = true;
+  for (const auto &outcome : pending) {
+    if (!outcome.ok)
+      return {false, "tool error"};
+    total_bytes += outcome.result_bytes;
+    bool mutation = outcome.name == "edit" || outcome.name == "write" ||
+                    outcome.name == "write_many" ||
+                    outcome.name == "multi_edit" ||
+                    outcome.name == "apply_patch";
+    bool command = outcome.name == "bash" || outcome.name == "execute_python";
+    if (!mutation && !command)
+      return {false, "needs reasoning"};
+    if (!mutation)
+      all_mutations = false;
+  }
+  if (all_mutations)
+    return {true, "after edit"};
+  if (total_bytes <= 1024)
+    return {true, "summarize"};
+  return {false, "large result"};
+}
+
 boost::asio::awaitable<void> Agent::run() {
   std::cout << BOLD << "nanocode-cpp" << RESET << " | " << current_model_
             << " | " << std::filesystem::current_path().string() << RESET
@@ -230,9 +378,26 @@ boost::asio::awaitable<void> Agent::run() {
             << "\n";
   std::cout << DIM << "  /c             - Clear current conversation context"
             << RESET << "\n";
+  std::cout << DIM << "  /fork <name>   - Branch the conversation here" << RESET
+            << "\n";
+  std::cout << DIM << "  /switch <name> - Switch to another branch" << RESET
+            << "\n";
+  std::cout << DIM << "  /route on|off  - Toggle fast-model routing" << RESET
+            << "\n";
+  std::cout << DIM << "  /stats         - Show session statistics" << RESET
+            << "\n";
+  std::cout << DIM << "  /undo [n]       - Revert file changes of last n turns"
+            << RESET << "\n";
+  std::cout << DIM << "  /mem           - Show memory use by component" << RESET
+            << "\n";
+  std::cout << DIM << "  /history search <query> - Search saved sessions"
+            << RESET << "\n";
+  std::cout << DIM << "  /history index <dir>    - Index existing saves"
+            << RESET << "\n";
   std::cout << DIM << "  /q or /exit    - Quit application" << RESET << "\n\n";
 
-  system_prompt_ = "Concise coding assistant.";
+  term::out().set_frame_rate(agent_config_.output_fps);
+  term::out().attach(co_await boost::asio::this_coro::executor);
 
   replxx::Replxx rx;
   rx.install_window_change_handler();
@@ -264,7 +429,13 @@ boost::asio::awaitable<void> Agent::run() {
         }
 
         if (input[0] == '/') {
-          const char *cmds[] = {"/save ", "/load ", "/c", "/q", "/exit"};
+          const char *cmds[] = {"/save ",           "/load ",
+                                "/c",               "/fork ",
+                                "/switch ",         "/route on",
+                                "/route off",       "/stats",
+                                "/history search ", "/history index ",
+                                "/undo",            "/mem",
+                                "/q",               "/exit"};
           for (const auto &cmd : cmds) {
             if (std::string(cmd).starts_with(input)) {
               completions.emplace_back(cmd);
@@ -295,11 +466,124 @@ boost::asio::awaitable<void> Agent::run() {
     if (user_input == "/q" || user_input == "exit" || user_input == "/exit")
       break;
     if (user_input == "/c") {
-      messages_.clear();
+      reset_history();
       std::cout << GREEN << "⏺ Cleared conversation" << RESET << "\n";
       continue;
     }
 
+    if (user_input.starts_with("/fork ")) {
+      std::string name = user_input.substr(6);
+      if (name.empty())
+        continue;
+      if (name == branch_ || parked_branches_.contains(name)) {
+        std::cout << RED << "⏺ Branch " << name << " already exists" << RESET
+                  << "\n";
+        continue;
+      }
+      // The copy shares every message with the parked parent.
+      parked_branches_[branch_] = {messages_, cache_mark_};
+      std::cout << GREEN << "⏺ Forked " << name << " from " << branch_
+                << " at " << messages_.size() << " messages" << RESET << "\n";
+      branch_ = std::move(name);
+      continue;
+    }
+
+    if (user_input == "/switch" || user_input.starts_with("/switch ")) {
+      std::string name = user_input.size() > 8 ? user_input.substr(8) : "";
+      auto it = parked_branches_.find(name);
+      if (it == parked_branches_.end()) {
+        std::cout << DIM << "branches: * " << branch_ << " ("
+                  << messages_.size() << " messages)";
+        for (const auto &[other, branch] : parked_branches_)
+          std::cout << ", " << other << " (" << branch.history.size()
+                    << " messages)";
+        std::cout << RESET << "\n";
+        continue;
+      }
+      Branch next = std::move(it->second);
+      parked_branches_.erase(it);
+      parked_branches_[branch_] = {std::move(messages_), cache_mark_};
+      messages_ = std::move(next.history);
+      cache_mark_ = next.cache_mark;
+      branch_ = std::move(name);
+      std::cout << GREEN << "⏺ Switched to branch " << branch_ << " ("
+                << messages_.size() << " messages)" << RESET << "\n";
+      continue;
+    }
+
+    if (user_input == "/route on" || user_input == "/route off") {
+      routing_enabled_ = user_input == "/route on";
+      if (agent_config_.fast_model.empty()) {
+        std::cout << YELLOW << "⏺ No fast model configured (--fast-model)"
+                  << RESET << "\n";
+      } else {
+        std::cout << GREEN << "⏺ Fast-model routing "
+                  << (routing_enabled_ ? "enabled" : "disabled") << RESET
+                  << "\n";
+      }
+      continue;
+    }
+
+    if (user_input == "/stats") {
+      std::cout << DIM << "turns: " << stats_.main_turns << " main ("
+                << current_model_ << "), " << stats_.fast_turns << " fast ("
+                << (agent_config_.fast_model.empty() ? "none"
+                                                     : agent_config_.fast_model)
+                << "), " << stats_.escalations << " escalations" << RESET
+                << "\n";
+      for (const auto &[reason, count] : stats_.route_reasons)
+        std::cout << DIM << "  " << reason << ": " << count << RESET << "\n";
+      if (unsigned turns = stats_.main_turns + stats_.fast_turns) {
+        std::cout << DIM << "allocations: " << stats_.last_turn_allocations
+                  << " last turn, " << stats_.turn_allocations / turns
+                  << " avg per turn" << RESET << "\n";
+      }
+      if (stats_.input_tokens || stats_.output_tokens)
+        std::cout << DIM << "tokens: " << stats_.input_tokens << " in, "
+                  << stats_.output_tokens << " out" << RESET << "\n";
+      if (auto cache = tools::file_cache().stats(); cache.hits || cache.misses)
+        std::cout << DIM << "file cache: " << cache.hits << " hits ("
+                  << cache.prefetch_hits << " prefetched), " << cache.misses
+                  << " misses, " << cache.prefetched << " files prefetched"
+                  << RESET << "\n";
+      if (agent_config_.repo_map_tokens)
+        std::cout << DIM << "repo map: " << repo_map_.files() << " files, "
+                  << system_prompt_.size() << " bytes of system prompt"
+                  << RESET << "\n";
+      if (std::uint64_t spilled = spill_.bytes())
+        std::cout << DIM << "spilled tool output: " << spilled / 1024
+                  << " KiB" << RESET << "\n";
+      continue;
+    }
+
+    if (user_input == "/mem") {
+      MemoryUsage usage = memory_usage();
+      auto line = [](std::string_view what, std::uint64_t bytes) {
+        std::cout << DIM
+                  << std::format("  {:<16}{:>10.1f} MiB", what,
+                                 static_cast<double>(bytes) / (1024 * 1024))
+                  << RESET << "\n";
+      };
+      std::cout << DIM << "memory"
+                << (agent_config_.memory_limit
+                        ? std::format(" (limit {} MiB)",
+                                      agent_config_.memory_limit >> 20)
+                        : std::string())
+                << ":" << RESET << "\n";
+      line("history", usage.history);
+      line("file cache", usage.file_cache);
+      line("session index", usage.session_index);
+      line("repo map", usage.repo_map);
+      line("request buffer", usage.request_buffer);
+      line("tracked", usage.tracked());
+      if (usage.heap_in_use)
+        line("heap in use", usage.heap_in_use);
+      if (usage.resident)
+        line("resident", usage.resident);
+      line("spilled (file)", usage.spilled);
+      continue;
+    }
+
     if (user_input.starts_with("/model ")) {
       std::string new_model = user_input.substr(7);
       if (!new_model.empty()) {
@@ -320,8 +604,15 @@ boost::asio::awaitable<void> Agent::run() {
         if (out) {
           boost::json::object save_data;
           save_data["model"] = current_model_;
-          save_data["messages"] = boost::json::value_from(messages_);
+          boost::json::array saved;
+          saved.reserve(messages_.size());
+          for (const Message *m : messages_.messages())
+            saved.push_back(to_json(*m));
+          save_data["messages"] = std::move(saved);
           out << boost::json::serialize(save_data);
+          out.close();
+          if (out && !agent_config_.session_index_path.empty())
+            session_index_.add(filename, messages_);
           std::cout << GREEN << "⏺ Saved conversation and model context to "
                     << filename << RESET << "\n";
         } else {
@@ -332,49 +623,125 @@ boost::asio::awaitable<void> Agent::run() {
       continue;
     }
 
+    if (user_input.starts_with("/history search ")) {
+      if (agent_config_.session_index_path.empty()) {
+        std::cout << YELLOW << "⏺ Session index disabled (no $HOME)" << RESET
+                  << "\n";
+        continue;
+      }
+      auto start = std::chrono::steady_clock::now();
+      last_hits_ = session_index_.search(user_input.substr(16));
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+      if (last_hits_.empty()) {
+        std::cout << DIM << "no matches in " << session_index_.size()
+                  << " sessions (" << ms << " ms)" << RESET << "\n";
+        continue;
+      }
+      for (std::size_t i = 0; i < last_hits_.size(); ++i) {
+        const SearchHit &hit = last_hits_[i];
+        std::cout << CYAN << "#" << i + 1 << RESET << " " << hit.path << DIM
+                  << " (" << hit.messages << " messages)" << RESET << "\n";
+        if (!hit.title.empty())
+          std::cout << DIM << "   " << hit.title << RESET << "\n";
+      }
+      std::cout << DIM << last_hits_.size() << " of " << session_index_.size()
+                << " sessions (" << ms << " ms), /load #N to open" << RESET
+                << "\n";
+      // Enter on the next prompt loads the best match.
+      rx.set_preload_buffer("/load " + last_hits_.front().path);
+      continue;
+    }
+
+    if (user_input.starts_with("/history index ")) {
+      if (agent_config_.session_index_path.empty()) {
+        std::cout << YELLOW << "⏺ Session index disabled (no $HOME)" << RESET
+                  << "\n";
+        continue;
+      }
+      std::error_code ec;
+      std::size_t indexed = 0;
+      std::filesystem::recursive_directory_iterator it(
+          user_input.substr(15),
+          std::filesystem::directory_options::skip_permission_denied, ec);
+      for (; !ec && it != std::filesystem::recursive_directory_iterator();
+           it.increment(ec)) {
+        std::error_code file_ec;
+        if (!it->is_regular_file(file_ec) ||
+            it->path().extension() != ".json")
+          continue;
+        std::ifstream in(it->path(), std::ios::binary);
+        Interner interner;
+        auto loaded = load_session(in, 0, interner,
+                                   boost::json::make_shared_resource<
+                                       boost::json::monotonic_resource>());
+        if (loaded && !loaded->history.empty() &&
+            session_index_.add(it->path().string(), loaded->history))
+          ++indexed;
+      }
+      std::cout << GREEN << "⏺ Indexed " << indexed << " sessions" << RESET
+                << "\n";
+      continue;
+    }
+
     if (user_input.starts_with("/load ")) {
       std::string filename = user_input.substr(6);
+      if (filename.starts_with("#")) {
+        std::size_t n = std::strtoul(filename.c_str() + 1, nullptr, 10);
+        if (n == 0 || n > last_hits_.size()) {
+          std::cout << RED << "⏺ No search hit " << filename << RESET << "\n";
+          continue;
+        }
+        filename = last_hits_[n - 1].path;
+      }
       if (!filename.empty()) {
-        std::ifstream in(filename);
+        std::ifstream in(filename, std::ios::binary);
         if (in) {
-          std::string content((std::istreambuf_iterator<char>(in)),
-                              std::istreambuf_iterator<char>());
-          boost::system::error_code ec;
-          auto parsed = boost::json::parse(content, ec);
-          if (!ec) {
-            if (parsed.is_object()) {
-              auto obj = parsed.as_object();
-              if (obj.contains("model") && obj.at("model").is_string()) {
-                current_model_ = obj.at("model").as_string().c_str();
-              }
-              if (obj.contains("messages") && obj.at("messages").is_array()) {
-                messages_.clear();
-                for (auto &item : obj.at("messages").as_array()) {
-                  messages_.push_back(item);
-                }
-              }
-              std::cout << BOLD << "nanocode-cpp" << RESET << " | "
-                        << current_model_ << " | "
-                        << std::filesystem::current_path().string() << RESET
-                        << "\n";
-              std::cout << GREEN
-                        << "⏺ Loaded conversation and restored model from "
-                        << filename << RESET << "\n";
-            } else if (parsed.is_array()) {
-              // Backward compatibility for old raw-array saves
-              messages_.clear();
-              for (auto &item : parsed.as_array()) {
-                messages_.push_back(item);
-              }
-              std::cout << GREEN << "⏺ Loaded legacy conversation from "
-                        << filename << RESET << "\n";
-            } else {
-              std::cout << RED << "⏺ Invalid save file format in " << filename
-                        << RESET << "\n";
-            }
+          std::error_code size_ec;
+          std::uint64_t size = std::filesystem::file_size(filename, size_ec);
+          if (size_ec)
+            size = 0;
+          // Load beside the current conversation, which stays intact if the
+          // file turns out to be bad.
+          Interner interner;
+          auto sp = boost::json::make_shared_resource<
+              boost::json::monotonic_resource>();
+          auto loaded = load_session(
+              in, size, parked_branches_.empty() ? interner : interner_, sp,
+              [](std::uint64_t done, std::uint64_t total) {
+                if (total > 0)
+                  std::cout << "\r" << DIM << "⏺ Loading "
+                            << done * 100 / total << "%" << RESET
+                            << std::flush;
+              });
+          std::cout << "\r\33[2K";
+          if (!loaded) {
+            std::cout << RED << "⏺ Failed to load " << filename << " ("
+                      << loaded.error() << "), conversation kept" << RESET
+                      << "\n";
+          } else if (loaded->legacy) {
+            // Backward compatibility for old raw-array saves
+            replace_history(std::move(loaded->history), std::move(interner),
+                            std::move(sp));
+            spill_cold_results();
+            enforce_memory_limit();
+            std::cout << GREEN << "⏺ Loaded legacy conversation from "
+                      << filename << RESET << "\n";
           } else {
-            std::cout << RED << "⏺ Failed to parse " << filename << " ("
-                      << ec.message() << ")" << RESET << "\n";
+            replace_history(std::move(loaded->history), std::move(interner),
+                            std::move(sp));
+            spill_cold_results();
+            enforce_memory_limit();
+            if (loaded->model)
+              current_model_ = std::move(*loaded->model);
+            std::cout << BOLD << "nanocode-cpp" << RESET << " | "
+                      << current_model_ << " | "
+                      << std::filesystem::current_path().string() << RESET
+                      << "\n";
+            std::cout << GREEN
+                      << "⏺ Loaded conversation and restored model from "
+                      << filename << RESET << "\n";
           }
         } else {
           std::cout << RED << "⏺ Failed to open " << filename << " for reading"
@@ -384,22 +751,105 @@ boost::asio::awaitable<void> Agent::run() {
       continue;
     }
 
-    messages_.push_back({{"role", "user"}, {"content", user_input}});
+    if (user_input == "/undo" || user_input.starts_with("/undo ")) {
+      std::size_t n = 1;
+      if (user_input.size() > 6)
+        n = std::max<std::size_t>(
+            1, std::strtoul(user_input.c_str() + 6, nullptr, 10));
+      auto undone = checkpoints_.undo(n);
+      if (undone.empty()) {
+        std::cout << DIM << "nothing to undo" << RESET << "\n";
+        continue;
+      }
+      std::string files;
+      for (const auto &checkpoint : undone) {
+        std::cout << GREEN << "⏺ Undid " << checkpoint.label << RESET << "\n";
+        for (const auto &file : checkpoint.files) {
+          std::cout << DIM << "  ⎿  " << file << RESET << "\n";
+          files += "\n- " + file;
+        }
+      }
+      undo_note_ += "[The user reverted the file changes made in the last " +
+                    std::to_string(undone.size()) +
+                    " tool turn(s). These files are back to their earlier "
+                    "contents:" +
+                    files + "]\n";
+      continue;
+    }
+
+    Message prompt{Role::user, {}};
+    if (!undo_note_.empty())
+      prompt.content.push_back(TextBlock{std::move(undo_note_)});
+    undo_note_.clear();
+    prompt.content.push_back(TextBlock{user_input});
+    messages_.push_back(std::move(prompt));
 
+    std::cout << std::flush;
+    escalated_ = false;
     co_await run_agentic_loop();
-    std::cout << "\n";
+    term::out().write("\n");
+    // Hand the terminal back to replxx / std::cout.
+    term::out().flush();
+    spill_cold_results();
   }
 }
 
-boost::asio::awaitable<void> Agent::run_agentic_loop() {
-  while (true) {
-    LLMConfig config_ = get_llm_config();
-    boost::json::object payload;
+boost::asio::awaitable<bool> Agent::run_task(std::string prompt) {
+  term::out().set_frame_rate(agent_config_.output_fps);
+  term::out().attach(co_await boost::asio::this_coro::executor);
+  messages_.push_back({Role::user, {TextBlock{std::move(prompt)}}});
+  bool ok = co_await run_agentic_loop();
+  term::out().write("\n");
+  term::out().flush();
+  co_return ok;
+}
+
+boost::asio::awaitable<bool> Agent::run_agentic_loop() {
+  std::vector<ToolOutcome> pending;
+  // Checkpoints are labelled with the prompt that led to them.
+  std::string prompt_preview;
+  for (const Message *m : messages_.messages() | std::views::reverse) {
+    if (m->role != Role::user || m->content.empty())
+      continue;
+    if (auto *text = std::get_if<TextBlock>(&m->content.back())) {
+      prompt_preview = text->text.substr(0, 40);
+      break;
+    }
+  }
+  for (unsigned turns = 0;; ++turns) {
+    if (agent_config_.max_turns && turns == agent_config_.max_turns) {
+      term::out().write(YELLOW + "\n⏺ Stopped after " +
+                        std::to_string(turns) + " turns" + RESET + "\n");
+      co_return false;
+    }
+    trace::Span turn_span("turn", trace::Track::agent);
+    TurnAllocations turn_allocs{stats_};
+    RouteDecision route = route_turn(pending);
+    if (std::size_t over = enforce_memory_limit(); over && !memory_warned_) {
+      memory_warned_ = true;
+      term::out().write(YELLOW + "\n⏺ Memory limit exceeded by " +
+                        std::to_string(over >> 20) +
+                        " MiB after trimming caches and spilling tool "
+                        "results; /save and /c to start over" +
+                        RESET + "\n");
+    }
+    const std::string &model =
+        route.use_fast ? agent_config_.fast_model : current_model_;
+    ++(route.use_fast ? stats_.fast_turns : stats_.main_turns);
+    ++stats_.route_reasons[route.reason];
+    pending.clear();
+
+    LLMConfig config_ = get_llm_config(model);
+    trace::Span payload_span("build_payload", trace::Track::agent);
+    std::string payload;
     if (config_.is_anthropic_format) {
-      payload = build_anthropic_payload();
+      payload = build_anthropic_payload(model, true);
     } else {
-      payload = build_openai_payload();
+      payload = build_openai_payload(model, true);
     }
+    // Spilled results were only needed to serialize the payload.
+    spill_.drop_pages();
+    payload_span.end();
 
     bool printed_prefix = false;
     auto spinner_active = std::make_shared<bool>(true);
@@ -412,8 +862,9 @@ boost::asio::awaitable<void> Agent::run_agentic_loop() {
           boost::asio::steady_timer timer(
               co_await boost::asio::this_coro::executor);
           while (*spinner_active) {
-            std::cout << "\r" << DIM << "⏺ Thinking " << spinner[i++ % 4]
-                      << RESET << std::flush;
+            // Spinner frames are dropped while real output is pending.
+            term::out().write_frame("\r" + DIM + "⏺ Thinking " +
+                                    spinner[i++ % 4] + RESET);
             timer.expires_after(std::chrono::milliseconds(100));
             boost::system::error_code ec;
             co_await timer.async_wait(
@@ -422,84 +873,128 @@ boost::asio::awaitable<void> Agent::run_agentic_loop() {
         },
         boost::asio::detached);
 
-    auto on_chunk = [&printed_prefix,
+    markdown::StreamRenderer renderer;
+    std::string rendered;
+    auto on_chunk = [&printed_prefix, &renderer, &rendered,
                      spinner_active](const std::string &chunk) {
+      trace::Span render_span("render", trace::Track::output);
+      rendered.clear();
       if (*spinner_active) {
         *spinner_active = false;
-        std::cout << "\r\33[2K" << std::flush;
+        rendered += "\r\33[2K";
       }
       if (!printed_prefix) {
-        std::cout << "\n" << CYAN << "⏺" << RESET << " ";
+        rendered += "\n" + CYAN + "⏺" + RESET + " ";
         printed_prefix = true;
       }
-      std::cout << chunk << std::flush;
+      renderer.feed(chunk, rendered);
+      term::out().write(rendered);
     };
 
     auto result_expected =
-        co_await llm::send_request(config_, payload, on_chunk);
+        agent_config_.replay
+            ? agent_config_.replay->next(on_chunk)
+            : co_await llm::send_request(config_, std::move(payload), on_chunk);
 
     if (*spinner_active) {
       *spinner_active = false;
-      std::cout << "\r\33[2K" << std::flush;
+      term::out().write("\r\33[2K");
     }
     if (!result_expected.has_value()) {
-      std::cout << RED << "\n⏺ Error: " << result_expected.error() << RESET
-                << "\n";
-      break;
+      term::out().write(RED + "\n⏺ Error: " + result_expected.error() +
+                        RESET + "\n");
+      co_return false;
     }
+    stats_.input_tokens += result_expected->input_tokens;
+    stats_.output_tokens += result_expected->output_tokens;
+    if (!agent_config_.record_path.empty() && !agent_config_.replay)
+      llm::record_response(agent_config_.record_path, *result_expected);
+    // The provider has now cached everything sent in this request.
+    cache_mark_ = messages_.size();
 
     if (printed_prefix) {
-      std::cout << "\n";
+      rendered.clear();
+      renderer.finish(rendered);
+      rendered += "\n";
+      term::out().write(rendered);
     }
 
-    boost::json::object raw_resp = result_expected.value().raw_json;
+    boost::json::object &raw_resp = result_expected->raw_json;
 
     if (raw_resp.contains("error")) {
-      std::cout << RED << "\n⏺ API Error: "
-                << boost::json::serialize(raw_resp.at("error")) << RESET
-                << "\n";
-      break;
+      term::out().write(RED + "\n⏺ API Error: " +
+                        boost::json::serialize(raw_resp.at("error")) + RESET +
+                        "\n");
+      co_return false;
     }
 
-    boost::json::object content_data;
+    Message reply{Role::assistant, {}};
     if (config_.is_anthropic_format) {
-      content_data = raw_resp;
+      if (auto it = raw_resp.find("content"); it != raw_resp.end())
+        reply.content =
+            content_from_json(std::move(it->value()), interner_, history_sp_);
     } else {
-      content_data = normalize_openai_response(raw_resp);
+      reply = normalize_openai_response(raw_resp);
     }
 
-    const auto &content_blocks = content_data.at("content").as_array();
-    boost::json::array tool_results;
-
-    for (const auto &block_val : content_blocks) {
-      const auto &block = block_val.as_object();
-      std::string type = block.at("type").as_string().c_str();
+    std::vector<ContentBlock> tool_results;
+    checkpoints_.begin("turn " + std::to_string(turns + 1) + " of \"" +
+                       prompt_preview + "\"");
 
-      if (type == "text") {
-        // Text is already streamed to stdout, do nothing.
-      }
+    for (const auto &block : reply.content) {
+      // Text is already streamed to stdout, only tool calls need handling.
+      if (auto *use = std::get_if<ToolUseBlock>(&block)) {
+        std::string tool_name(use->name);
+        const auto &tool_args = use->input;
 
-      if (type == "tool_use") {
-        std::string tool_name = block.at("name").as_string().c_str();
-        const auto &tool_args = block.at("input").as_object();
+        term::out().write("\n" + GREEN + "⏺ " + tool_name + RESET + "(" +
+                          DIM + preview_args(tool_args) + RESET + ")\n");
 
-        std::string arg_preview;
-        if (!tool_args.empty()) {
-          arg_preview =
-              boost::json::serialize(tool_args.begin()->value()).substr(0, 50);
+        trace::Span tool_span(tool_name, trace::Track::tools);
+        if (tool_name == "write" || tool_name == "edit" ||
+            tool_name == "multi_edit") {
+          if (auto *path = tool_args.if_contains("path");
+              path && path->is_string())
+            checkpoints_.record(std::string_view(path->get_string().data(),
+                                                 path->get_string().size()));
+        } else if (tool_name == "write_many") {
+          if (auto *files = tool_args.if_contains("files");
+              files && files->is_array())
+            for (const auto &file : files->get_array())
+              if (auto *path = file.is_object()
+                                   ? file.get_object().if_contains("path")
+                                   : nullptr;
+                  path && path->is_string())
+                checkpoints_.record(std::string_view(
+                    path->get_string().data(), path->get_string().size()));
+        } else if (tool_name == "apply_patch") {
+          if (auto *patch = tool_args.if_contains("patch");
+              patch && patch->is_string())
+            for (const auto &path : tools::patch_paths(
+                     std::string_view(patch->get_string().data(),
+                                      patch->get_string().size())))
+              checkpoints_.record(path);
+        } else if (tool_name == "bash") {
+          if (auto *cmd = tool_args.if_contains("cmd"); cmd && cmd->is_string())
+            for (const auto &path : bash_mutations(std::string_view(
+                     cmd->get_string().data(), cmd->get_string().size())))
+              checkpoints_.record(path);
         }
-
-        std::cout << "\n"
-                  << GREEN << "⏺ " << tool_name << RESET << "(" << DIM
-                  << arg_preview << RESET << ")\n";
-
         tools::ToolResult res;
         if (tool_name == "read")
           res = tools::execute_read(tool_args);
+        else if (tool_name == "read_many")
+          res = tools::execute_read_many(tool_args);
         else if (tool_name == "write")
           res = tools::execute_write(tool_args);
+        else if (tool_name == "write_many")
+          res = tools::execute_write_many(tool_args);
         else if (tool_name == "edit")
           res = tools::execute_edit(tool_args);
+        else if (tool_name == "multi_edit")
+          res = tools::execute_multi_edit(tool_args);
+        else if (tool_name == "apply_patch")
+          res = tools::execute_apply_patch(tool_args);
         else if (tool_name == "grep")
           res = tools::execute_grep(tool_args);
         else if (tool_name == "bash")
@@ -510,8 +1005,15 @@ boost::asio::awaitable<void> Agent::run_agentic_loop() {
           res = tools::execute_python(tool_args);
         else
           res = std::unexpected("error: unknown tool " + tool_name);
+        tool_span.end();
 
-        std::string res_str = res.has_value() ? res.value() : res.error();
+        std::string res_str =
+            res.has_value() ? std::move(*res) : std::move(res.error());
+        pending.push_back({tool_name, res.has_value(), res_str.size()});
+        if (route.use_fast && !res.has_value() && !escalated_) {
+          escalated_ = true;
+          ++stats_.escalations;
+        }
 
         // Truncate preview
         std::string preview;
@@ -525,19 +1027,17 @@ boost::asio::awaitable<void> Agent::run_agentic_loop() {
             preview += "...";
         }
 
-        std::cout << "  " << DIM << "⎿  " << preview << RESET << "\n";
+        term::out().write("  " + DIM + "⎿  " + preview + RESET + "\n");
 
-        tool_results.push_back({{"type", "tool_result"},
-                                {"tool_use_id", block.at("id")},
-                                {"content", res_str}});
+        tool_results.push_back(ToolResultBlock{use->id, std::move(res_str)});
       }
     }
 
-    messages_.push_back({{"role", "assistant"}, {"content", content_blocks}});
+    messages_.push_back(std::move(reply));
 
     if (tool_results.empty())
-      break;
-    messages_.push_back({{"role", "user"}, {"content", tool_results}});
+      co_return true;
+    messages_.push_back({Role::user, std::move(tool_results)});
   }
 }
 
@@ -1,9 +1,20 @@
 #pragma once
 
+#include "checkpoint.hpp"
+#include "history.hpp"
 #include "llm_client.hpp"
+#include "message.hpp"
+#include "repo_map.hpp"
+#include "session_index.hpp"
+#include "spill.hpp"
 #include <boost/asio/awaitable.hpp>
 #include <boost/json.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace agent {
 
@@ -12,6 +23,76 @@ struct AgentConfig {
   std::string anthropic_key;
   std::string openrouter_key;
   std::string initial_model;
+  // Optional cheap model for mechanical turns; empty disables routing.
+  std::string fast_model;
+  // Terminal output frames per second; writes are coalesced per frame.
+  unsigned output_fps = 60;
+  // On-disk search index over saved sessions; empty disables indexing.
+  std::string session_index_path;
+  // Model turns allowed per prompt; 0 means no limit.
+  unsigned max_turns = 0;
+  // Offline runs answer from recorded responses instead of the network.
+  std::shared_ptr<llm::Replay> replay;
+  // File `replay` was loaded from. Eval jobs load it afresh so that each
+  // task starts from the first response.
+  std::string replay_path;
+  // Appends every live response here for later replay; empty disables.
+  std::string record_path;
+  // Size of the repository map in the system prompt; 0 leaves it out.
+  std::size_t repo_map_tokens = 1024;
+  // Heap bytes the session should stay under; caches are trimmed and tool
+  // results spilled to keep it there. 0 means no limit.
+  std::size_t memory_limit = 0;
+};
+
+// Outcome of one tool call, as seen by the routing policy on the next turn.
+struct ToolOutcome {
+  std::string name;
+  // False for tool errors, including commands that exited non-zero.
+  bool ok = false;
+  std::size_t result_bytes = 0;
+};
+
+struct RouteDecision {
+  bool use_fast = false;
+  std::string reason;
+};
+
+struct SessionStats {
+  unsigned main_turns = 0;
+  unsigned fast_turns = 0;
+  // Fast turns whose tool calls failed, forcing the main model back in.
+  unsigned escalations = 0;
+  std::map<std::string, unsigned> route_reasons;
+  // Heap allocations (global operator new) made during agent turns.
+  std::size_t last_turn_allocations = 0;
+  std::size_t turn_allocations = 0;
+  std::uint64_t input_tokens = 0;
+  std::uint64_t output_tokens = 0;
+};
+
+// Bytes attributed to each consumer, as shown by /mem.
+struct MemoryUsage {
+  // Messages of all branches, shared messages counted once.
+  std::size_t history = 0;
+  std::size_t file_cache = 0;
+  std::size_t session_index = 0;
+  std::size_t repo_map = 0;
+  // Body of the last request; rebuilt for every turn.
+  std::size_t request_buffer = 0;
+  // Whole-process figures; 0 where the platform cannot report them.
+  std::size_t heap_in_use = 0;
+  std::size_t resident = 0;
+  // File-backed, outside the heap.
+  std::uint64_t spilled = 0;
+
+  std::size_t tracked() const {
+    return history + file_cache + session_index + repo_map + request_buffer;
+  }
+  // What the memory limit is checked against.
+  std::size_t footprint() const {
+    return heap_in_use ? heap_in_use : tracked();
+  }
 };
 
 class Agent {
@@ -21,24 +102,92 @@ public:
   // Run the interactive agent loop
   boost::asio::awaitable<void> run();
 
+  // Runs a single prompt to completion without the REPL. Returns false if
+  // the loop stopped on an error or the turn limit.
+  boost::asio::awaitable<bool> run_task(std::string prompt);
+
+  const SessionStats &stats() const { return stats_; }
+
+  // With `exact_history` false the history comes from running totals
+  // instead of a walk, counting messages shared by branches once per branch.
+  MemoryUsage memory_usage(bool exact_history = true) const;
+
 private:
   AgentConfig agent_config_;
   std::string current_model_;
-  std::vector<boost::json::value> messages_;
+  // Monotonic arena for tool inputs built or copied into the history: those
+  // parsed from OpenAI tool calls and those read by /load. Inputs moved out
+  // of an Anthropic response keep the storage they were parsed with. /c and
+  // /load swap in a fresh arena.
+  boost::json::storage_ptr history_sp_;
+  Interner interner_;
+  // Cold tool results, moved out of the heap between prompts.
+  SpillFile spill_;
+  // Active branch. Forks share their common prefix (see History).
+  History messages_;
+  std::string branch_ = "main";
+  // Number of leading messages covered by this branch's last prompt-cache
+  // breakpoint; inherited by forks so they read the shared prefix from the
+  // provider cache.
+  std::size_t cache_mark_ = 0;
+
+  struct Branch {
+    History history;
+    std::size_t cache_mark = 0;
+  };
+  // Inactive branches, by name
+  std::map<std::string, Branch> parked_branches_;
   std::string system_prompt_;
+  // Orientation for the model, rendered into system_prompt_. It only
+  // changes when a conversation starts, so the system prompt stays in the
+  // provider's cached prefix.
+  RepoMap repo_map_;
+  // Size of the last request body, used to presize the next one.
+  std::size_t last_payload_size_ = 0;
+  SessionStats stats_;
+  SessionIndex session_index_;
+  // Results of the last /history search, addressable as /load #N.
+  std::vector<SearchHit> last_hits_;
+  // Pre-images of files mutated by tools, one checkpoint per turn.
+  Checkpoints checkpoints_;
+  // Tells the model about an /undo along with the next prompt.
+  std::string undo_note_;
+  // Set once the memory limit could not be met, to warn only once.
+  bool memory_warned_ = false;
+
+  // Fast-model routing. `/route off` is the per-session quality escape
+  // hatch; a failed tool call on a fast turn escalates to the main model
+  // for the rest of the current prompt.
+  bool routing_enabled_ = true;
+  bool escalated_ = false;
+
+  void reset_history();
+  // Installs a history built with `interner` and `sp`, then releases the
+  // old one. While branches are parked the current interner is kept, so the
+  // history must have been built with it.
+  void replace_history(History history, Interner interner,
+                       boost::json::storage_ptr sp);
+  // Rescans the tree and rebuilds system_prompt_ around the repository map.
+  void refresh_system_prompt();
+  // Moves bulky tool results outside the hot window to spill_.
+  void spill_cold_results();
+  // Trims caches, then spills tool results, while over the memory limit.
+  // Returns the bytes still over it.
+  std::size_t enforce_memory_limit();
+
+  LLMConfig get_llm_config(const std::string &model) const;
 
-  LLMConfig get_llm_config() const;
+  RouteDecision route_turn(const std::vector<ToolOutcome> &pending) const;
 
-  boost::asio::awaitable<void> run_agentic_loop();
+  boost::asio::awaitable<bool> run_agentic_loop();
 
-  // Translators for Gemini/OpenAI compatibility
-  boost::json::object build_anthropic_payload();
-  boost::json::object build_openai_payload();
+  // Serialize the request body for each wire format straight from the typed
+  // history (Gemini uses the OpenAI format).
+  std::string build_anthropic_payload(const std::string &model, bool stream);
+  std::string build_openai_payload(const std::string &model, bool stream);
 
-  // Translates an OpenAI response back to Anthropic structure for consistent
-  // internal handling
-  boost::json::object
-  normalize_openai_response(const boost::json::object &raw_resp);
+  // Translates an OpenAI response into the typed message model
+  Message normalize_openai_response(const boost::json::object &raw_resp);
 };
 
 } // namespace agent
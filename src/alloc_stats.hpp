@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+namespace alloc_stats {
+
+// Process-wide counters maintained by the replaced global operator new.
+std::size_t allocations();
+std::size_t bytes_allocated();
+
+// Heap bytes currently allocated, as reported by the allocator (malloc as a
+// whole, not just operator new); 0 where it cannot say. Costs a walk of the
+// allocator's free lists, so it is meant for periodic checks.
+std::size_t bytes_in_use();
+
+// Resident set size of the process; 0 where unavailable.
+std::size_t resident_bytes();
+
+} // namespace alloc_stats
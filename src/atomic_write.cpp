@@ -0,0 +1,248 @@
+#include "atomic_write.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace tools {
+
+namespace {
+
+std::atomic<unsigned> temp_counter{0};
+
+// A name beside `path`, so the final rename stays on one filesystem.
+std::string temp_name(const std::string &path, const char *tag) {
+  return path + ".nanocode-" + tag + "-" + std::to_string(::getpid()) + "-" +
+         std::to_string(temp_counter++);
+}
+
+std::string describe_errno(const char *what, const std::string &path) {
+  return std::string(what) + " " + path + ": " + std::strerror(errno);
+}
+
+// The file a write to `path` should replace: symlinks are followed so that
+// the link survives and its target gets the new contents.
+std::string resolve_target(const std::string &path) {
+  std::error_code ec;
+  if (fs::is_symlink(fs::symlink_status(path, ec)))
+    if (auto resolved = fs::canonical(path, ec); !ec)
+      return resolved.string();
+  return path;
+}
+
+// Creates `temp` holding `content`. When the target already exists its mode
+// (`existing`) is copied exactly; new files get the umask-filtered 0666.
+bool write_temp(const std::string &temp, std::string_view content,
+                const struct stat *existing, bool sync = false) {
+  int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+  if (fd < 0)
+    return false;
+  bool ok = !existing || ::fchmod(fd, existing->st_mode & 07777) == 0;
+  while (ok && !content.empty()) {
+    ssize_t n = ::write(fd, content.data(), content.size());
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      ok = false;
+      break;
+    }
+    content.remove_prefix(static_cast<std::size_t>(n));
+  }
+  if (ok && sync)
+    ok = ::fsync(fd) == 0;
+  int saved = errno;
+  if (::close(fd) != 0 && ok) {
+    ok = false;
+    saved = errno;
+  }
+  if (!ok) {
+    ::unlink(temp.c_str());
+    errno = saved;
+  }
+  return ok;
+}
+
+// Flushes the directory entry of a rename into `dir`.
+void sync_directory(const std::string &dir) {
+  int fd = ::open(dir.empty() ? "." : dir.c_str(),
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  ::fsync(fd);
+  ::close(fd);
+}
+
+// Writes `content` over `target` (already resolved) without flushing its
+// directory; see replace_file().
+std::expected<void, std::string> replace_target(const std::string &path,
+                                                const std::string &target,
+                                                std::string_view content,
+                                                const WriteOptions &options) {
+  struct stat st{};
+  bool existed = ::stat(target.c_str(), &st) == 0;
+  if (existed && !S_ISREG(st.st_mode))
+    return std::unexpected(path + " is not a regular file");
+  if (auto parent = fs::path(target).parent_path();
+      !existed && options.create_dirs && !parent.empty()) {
+    std::error_code ec;
+    fs::create_directories(parent, ec);
+  }
+  std::string temp = temp_name(target, "new");
+  if (!write_temp(temp, content, existed ? &st : nullptr, options.sync))
+    return std::unexpected(describe_errno("could not write", path));
+  if (::rename(temp.c_str(), target.c_str()) != 0) {
+    auto error = describe_errno("could not replace", path);
+    ::unlink(temp.c_str());
+    return std::unexpected(error);
+  }
+  return {};
+}
+
+struct Staged {
+  const FileWrite *write = nullptr;
+  std::string target;
+  std::string temp;
+  // Hard link to the previous contents, used to roll back.
+  std::string backup;
+  bool existed = false;
+  bool applied = false;
+};
+
+void discard(std::vector<Staged> &staged) {
+  for (auto &file : staged) {
+    if (!file.temp.empty())
+      ::unlink(file.temp.c_str());
+    if (!file.backup.empty())
+      ::unlink(file.backup.c_str());
+  }
+}
+
+} // namespace
+
+std::expected<void, std::string> replace_file(const std::string &path,
+                                              std::string_view content,
+                                              const WriteOptions &options) {
+  std::string target = resolve_target(path);
+  auto result = replace_target(path, target, content, options);
+  if (result && options.sync)
+    sync_directory(fs::path(target).parent_path().string());
+  return result;
+}
+
+std::vector<std::expected<void, std::string>>
+replace_files(std::span<const FileWrite> writes, const WriteOptions &options) {
+  std::vector<std::expected<void, std::string>> results(writes.size());
+  std::vector<std::string> targets(writes.size());
+  std::atomic<std::size_t> next{0};
+  auto work = [&] {
+    for (std::size_t i; (i = next++) < writes.size();) {
+      const FileWrite &write = writes[i];
+      if (!write.content) {
+        results[i] = std::unexpected("removal is not supported here");
+        continue;
+      }
+      targets[i] = resolve_target(write.path);
+      results[i] = replace_target(write.path, targets[i], *write.content,
+                                  options);
+    }
+  };
+  // Unsynced writes only touch the page cache, so they scale with cores;
+  // fsync waits on the disk, and more of them in flight fill its queue.
+  unsigned cores = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+  std::size_t n_threads =
+      std::min<std::size_t>(writes.size(), options.sync ? 16 : cores);
+  {
+    std::vector<std::jthread> threads;
+    for (std::size_t t = 1; t < n_threads; ++t)
+      threads.emplace_back(work);
+    work();
+  }
+
+  if (options.sync) {
+    std::vector<std::string> dirs;
+    for (std::size_t i = 0; i < writes.size(); ++i)
+      if (results[i])
+        dirs.push_back(fs::path(targets[i]).parent_path().string());
+    std::ranges::sort(dirs);
+    auto [first, last] = std::ranges::unique(dirs);
+    dirs.erase(first, last);
+    for (const auto &dir : dirs)
+      sync_directory(dir);
+  }
+  return results;
+}
+
+std::expected<void, std::string>
+commit_files(std::span<const FileWrite> writes) {
+  std::vector<Staged> staged(writes.size());
+  for (std::size_t i = 0; i < writes.size(); ++i) {
+    Staged &file = staged[i];
+    file.write = &writes[i];
+    file.target = resolve_target(writes[i].path);
+    std::error_code ec;
+
+    struct stat st{};
+    file.existed = ::stat(file.target.c_str(), &st) == 0;
+    if (!writes[i].content)
+      continue;
+    if (auto parent = fs::path(file.target).parent_path(); !parent.empty())
+      fs::create_directories(parent, ec);
+    std::string temp = temp_name(file.target, "new");
+    if (!write_temp(temp, *writes[i].content, file.existed ? &st : nullptr)) {
+      auto error = describe_errno("could not write", writes[i].path);
+      discard(staged);
+      return std::unexpected(error);
+    }
+    file.temp = std::move(temp);
+  }
+
+  // Nothing has changed yet. Keep a link to each old file so the renames
+  // below can be undone; where links are unsupported that file simply
+  // cannot be rolled back.
+  for (auto &file : staged) {
+    if (!file.existed)
+      continue;
+    std::string backup = temp_name(file.target, "old");
+    if (::link(file.target.c_str(), backup.c_str()) == 0)
+      file.backup = std::move(backup);
+  }
+
+  for (auto &file : staged) {
+    bool ok = file.write->content
+                  ? ::rename(file.temp.c_str(), file.target.c_str()) == 0
+                  : !file.existed || ::unlink(file.target.c_str()) == 0;
+    if (ok) {
+      file.applied = true;
+      file.temp.clear();
+      continue;
+    }
+    auto error = describe_errno(
+        file.write->content ? "could not replace" : "could not remove",
+        file.write->path);
+    for (auto &done : staged) {
+      if (!done.applied)
+        continue;
+      if (!done.backup.empty()) {
+        if (::rename(done.backup.c_str(), done.target.c_str()) == 0)
+          done.backup.clear();
+      } else if (!done.existed) {
+        ::unlink(done.target.c_str());
+      }
+    }
+    discard(staged);
+    return std::unexpected(error);
+  }
+
+  discard(staged);
+  return {};
+}
+
+} // namespace tools
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <expected>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tools {
+
+// One change in a commit_files() batch: new contents for `path`, or its
+// removal when `content` is empty.
+struct FileWrite {
+  std::string path;
+  std::optional<std::string_view> content;
+};
+
+struct WriteOptions {
+  // fsync each file before it is renamed into place, and its directory
+  // after, so the new contents survive a crash as well as an interruption.
+  bool sync = false;
+  // Create missing parent directories.
+  bool create_dirs = true;
+};
+
+// Replaces `path` with `content` through a temporary file beside it and
+// rename(2): readers, and a process killed mid-write, only ever see the old
+// file or the new one. The target's permissions are kept, and a symlink is
+// followed so the link itself survives.
+std::expected<void, std::string> replace_file(const std::string &path,
+                                              std::string_view content,
+                                              const WriteOptions &options = {});
+
+// replace_file() for each of `writes` (removals are not supported), run on
+// a small pool of threads. Files succeed or fail independently; result i
+// belongs to writes[i]. With `sync`, each directory is flushed once after
+// all of its files are in place rather than once per file.
+std::vector<std::expected<void, std::string>>
+replace_files(std::span<const FileWrite> writes,
+              const WriteOptions &options = {});
+
+// Applies `writes` as a unit. New contents are first written to temporary
+// files beside their targets, keeping the targets' permissions; only when
+// every one of them is on disk are they renamed into place and removals
+// carried out. If a step fails, the files already replaced are put back and
+// the error names the file that failed.
+std::expected<void, std::string>
+commit_files(std::span<const FileWrite> writes);
+
+} // namespace tools
@@ -0,0 +1,152 @@
+#include "batch_read.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace tools {
+
+namespace {
+
+// Files read but not yet handed to the caller; bounds the memory held for
+// out-of-order completions together with `max_bytes_in_flight`.
+constexpr std::size_t window = 64;
+constexpr std::size_t max_bytes_in_flight = 64 * 1024 * 1024;
+// Read size when the file's size is unknown.
+constexpr std::size_t first_read = 64 * 1024;
+
+struct Slot {
+  std::string data;
+  std::uint64_t size = 0;
+  // Bytes counted against max_bytes_in_flight until the slot is delivered.
+  std::size_t charged = 0;
+  int error = 0;
+  bool ready = false;
+};
+
+// Fills `slot` from `fd` up to `limit` bytes, growing the buffer if the
+// file turns out longer than `slot.data` expected.
+void read_into(int fd, std::size_t limit, Slot &slot) {
+  std::size_t filled = 0;
+  while (filled < slot.data.size()) {
+    ssize_t n =
+        ::read(fd, slot.data.data() + filled, slot.data.size() - filled);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      slot.error = errno;
+    if (n <= 0)
+      break;
+    filled += static_cast<std::size_t>(n);
+    // The file grew since fstat, or its size was unknown.
+    if (filled == slot.data.size() && slot.data.size() < limit)
+      slot.data.resize(std::min(slot.data.size() * 2, limit));
+  }
+  slot.data.resize(filled);
+}
+
+} // namespace
+
+void read_files(std::span<const std::string> paths,
+                const std::function<bool(std::size_t, const FileData &)> &on_file,
+                std::size_t max_bytes) {
+  if (paths.empty())
+    return;
+  std::vector<Slot> slots(window);
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::size_t next = 0;
+  std::size_t delivered = 0;
+  std::size_t in_flight = 0;
+  bool stop = false;
+
+  auto worker = [&] {
+    std::unique_lock lock(mutex);
+    while (true) {
+      cv.wait(lock, [&] {
+        return stop || next == paths.size() || next < delivered + window;
+      });
+      if (stop || next == paths.size())
+        return;
+      std::size_t i = next++;
+      lock.unlock();
+
+      Slot slot;
+      int fd = ::open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        slot.error = errno;
+      } else {
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+          slot.size = static_cast<std::uint64_t>(st.st_size);
+        std::size_t want = std::min<std::uint64_t>(
+            slot.size ? slot.size : first_read, max_bytes);
+        // The file the caller waits for always goes ahead, so the budget
+        // cannot hold up delivery.
+        lock.lock();
+        cv.wait(lock, [&] {
+          return stop || i == delivered ||
+                 in_flight + want <= max_bytes_in_flight;
+        });
+        in_flight += want;
+        lock.unlock();
+        slot.charged = want;
+        if (!stop) {
+          slot.data.resize(want);
+          read_into(fd, max_bytes, slot);
+          slot.size = std::max<std::uint64_t>(slot.size, slot.data.size());
+        }
+        ::close(fd);
+      }
+      slot.ready = true;
+      lock.lock();
+      slots[i % window] = std::move(slot);
+      cv.notify_all();
+    }
+  };
+  // Blocking I/O overlaps even on one core.
+  unsigned n_threads = std::clamp(std::thread::hardware_concurrency(), 4u, 16u);
+  std::vector<std::jthread> threads;
+  // Destroyed before `threads` joins them, so that an exception from
+  // on_file cannot leave workers waiting on a delivery that never comes.
+  struct StopWorkers {
+    std::mutex &mutex;
+    std::condition_variable &cv;
+    bool &stop;
+    ~StopWorkers() {
+      std::lock_guard lock(mutex);
+      stop = true;
+      cv.notify_all();
+    }
+  } stop_workers{mutex, cv, stop};
+  for (unsigned t = 0; t < n_threads && t < paths.size(); ++t)
+    threads.emplace_back(worker);
+
+  for (std::size_t i = 0; i < paths.size(); ++i) {
+    Slot *slot;
+    {
+      std::unique_lock lock(mutex);
+      cv.wait(lock, [&] { return slots[i % window].ready; });
+      slot = &slots[i % window];
+    }
+    // Workers do not touch this slot until `delivered` moves past it.
+    bool more = on_file(i, {slot->data, slot->error, slot->size});
+    std::lock_guard lock(mutex);
+    in_flight -= slot->charged;
+    *slot = Slot{};
+    ++delivered;
+    if (!more)
+      stop = true;
+    cv.notify_all();
+    if (stop)
+      break;
+  }
+}
+
+} // namespace tools
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace tools {
+
+// Contents of one file handed out by read_files(); `error` is an errno
+// value, 0 on success. `content` is only valid during the callback. `size`
+// is the file's size when it was opened, larger than `content` when the
+// file was cut at max_bytes.
+struct FileData {
+  std::string_view content;
+  int error = 0;
+  std::uint64_t size = 0;
+};
+
+// Reads `paths` on a small pool of threads with many opens and reads in
+// flight at once, so a walk over a cold tree waits on the disk's queue
+// rather than on each file in turn. `on_file(i, data)` is called on the
+// calling thread in path order; returning false stops the batch. Files are
+// cut at `max_bytes`, and read-ahead stops once the files waiting to be
+// handed out hold 64 MiB.
+void read_files(std::span<const std::string> paths,
+                const std::function<bool(std::size_t, const FileData &)> &on_file,
+                std::size_t max_bytes = 16 * 1024 * 1024);
+
+} // namespace tools
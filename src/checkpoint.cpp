@@ -0,0 +1,284 @@
+#include "checkpoint.hpp"
+#include "tools.hpp"
+
+#include <fcntl.h>
+#include <system_error>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#elif defined(__APPLE__)
+#include <sys/clonefile.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace agent {
+
+namespace {
+
+// Directories are recorded file by file; past this many files (a build
+// tree being wiped, say) the rest is left alone.
+constexpr std::size_t max_files_per_directory = 256;
+
+// Clones `from` to the new file `to`, sharing extents where the filesystem
+// can, and falls back to a copy.
+bool clone_file(const fs::path &from, const fs::path &to) {
+  std::error_code ec;
+#if defined(__linux__) && defined(FICLONE)
+  int src = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (src >= 0) {
+    int dst = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    bool cloned = dst >= 0 && ::ioctl(dst, FICLONE, src) == 0;
+    if (dst >= 0)
+      ::close(dst);
+    ::close(src);
+    if (cloned) {
+      fs::permissions(to, fs::status(from, ec).permissions(), ec);
+      return true;
+    }
+    fs::remove(to, ec);
+  }
+#elif defined(__APPLE__)
+  if (::clonefile(from.c_str(), to.c_str(), 0) == 0)
+    return true;
+#endif
+  return fs::copy_file(from, to, ec);
+}
+
+bool is_option(std::string_view word) {
+  return word.size() > 1 && word.front() == '-';
+}
+
+} // namespace
+
+Checkpoints::Checkpoints(fs::path dir) : dir_(std::move(dir)) {}
+
+Checkpoints::~Checkpoints() {
+  std::error_code ec;
+  if (next_id_)
+    fs::remove_all(dir_, ec);
+}
+
+void Checkpoints::begin(std::string label) {
+  if (stack_.empty() || !stack_.back().entries.empty())
+    stack_.emplace_back();
+  stack_.back().label = std::move(label);
+  stack_.back().seen.clear();
+}
+
+void Checkpoints::record(const fs::path &path) {
+  if (stack_.empty())
+    begin("");
+  std::error_code ec;
+  fs::path target = fs::weakly_canonical(fs::absolute(path, ec), ec);
+  if (ec || target.empty())
+    return;
+  // Never checkpoint the checkpoints themselves.
+  if (auto rel = target.lexically_relative(fs::absolute(dir_, ec));
+      !rel.empty() && *rel.begin() != "..")
+    return;
+
+  if (!fs::is_directory(target, ec)) {
+    record_file(target);
+    return;
+  }
+  std::size_t files = 0;
+  for (fs::recursive_directory_iterator it(
+           target, fs::directory_options::skip_permission_denied, ec);
+       !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    if (!it->is_regular_file(ec))
+      continue;
+    if (++files > max_files_per_directory)
+      break;
+    record_file(it->path());
+  }
+}
+
+void Checkpoints::record_file(const fs::path &path) {
+  Checkpoint &current = stack_.back();
+  if (!current.seen.insert(path.string()).second)
+    return;
+
+  std::error_code ec;
+  auto status = fs::symlink_status(path, ec);
+  if (!fs::exists(status)) {
+    current.entries.push_back({path, {}});
+    return;
+  }
+  if (!fs::is_regular_file(status))
+    return;
+
+  tools::create_state_dir(dir_);
+  fs::path saved = dir_ / std::to_string(next_id_++);
+  if (clone_file(path, saved))
+    current.entries.push_back({path, std::move(saved)});
+}
+
+std::vector<Checkpoints::Undone> Checkpoints::undo(std::size_t n) {
+  std::vector<Undone> undone;
+  while (n > 0 && !stack_.empty()) {
+    Checkpoint checkpoint = std::move(stack_.back());
+    stack_.pop_back();
+    if (checkpoint.entries.empty())
+      continue;
+    --n;
+
+    Undone result{std::move(checkpoint.label), {}};
+    for (auto it = checkpoint.entries.rbegin(); it != checkpoint.entries.rend();
+         ++it) {
+      std::error_code ec;
+      if (it->saved.empty()) {
+        fs::remove(it->path, ec);
+      } else {
+        fs::create_directories(it->path.parent_path(), ec);
+        fs::rename(it->saved, it->path, ec);
+      }
+      if (!ec)
+        result.files.push_back(it->path.string());
+    }
+    undone.push_back(std::move(result));
+  }
+  return undone;
+}
+
+std::size_t Checkpoints::size() const {
+  std::size_t n = 0;
+  for (const auto &checkpoint : stack_)
+    n += !checkpoint.entries.empty();
+  return n;
+}
+
+std::vector<std::string> bash_mutations(std::string_view cmd) {
+  // Split into words, honouring quotes and backslashes; control operators
+  // end the current simple command and become their own word.
+  std::vector<std::vector<std::string>> commands(1);
+  std::string word;
+  bool in_word = false;
+  auto end_word = [&]() {
+    if (in_word)
+      commands.back().push_back(std::move(word));
+    word.clear();
+    in_word = false;
+  };
+  for (std::size_t i = 0; i < cmd.size(); ++i) {
+    char c = cmd[i];
+    if (c == '\'' || c == '"') {
+      std::size_t close = cmd.find(c, i + 1);
+      if (close == std::string_view::npos)
+        close = cmd.size();
+      word.append(cmd.substr(i + 1, close - i - 1));
+      in_word = true;
+      i = close;
+    } else if (c == '\\' && i + 1 < cmd.size()) {
+      word += cmd[++i];
+      in_word = true;
+    } else if (c == ' ' || c == '\t') {
+      end_word();
+    } else if (c == ';' || c == '|' || c == '&' || c == '\n' || c == '(' ||
+               c == ')') {
+      // `&>` and `>&` belong to a redirection, not a separator.
+      if (c == '&' && i + 1 < cmd.size() && cmd[i + 1] == '>') {
+        end_word();
+        continue;
+      }
+      if (c == '&' && in_word && word.back() == '>') {
+        word += c;
+        continue;
+      }
+      end_word();
+      if (!commands.back().empty())
+        commands.emplace_back();
+    } else {
+      word += c;
+      in_word = true;
+    }
+  }
+  end_word();
+
+  std::vector<std::string> paths;
+  auto add = [&](const std::string &path) {
+    if (!path.empty() && path != "/dev/null" && !path.starts_with("/dev/fd/"))
+      paths.push_back(path);
+  };
+
+  for (auto &words : commands) {
+    // Redirections can appear anywhere; pull them out first.
+    std::vector<std::string> args;
+    for (std::size_t i = 0; i < words.size(); ++i) {
+      std::string_view w = words[i];
+      std::size_t digits = 0;
+      while (digits < w.size() && w[digits] >= '0' && w[digits] <= '9')
+        ++digits;
+      std::string_view rest = w.substr(digits);
+      if (!rest.starts_with('>')) {
+        args.push_back(std::move(words[i]));
+        continue;
+      }
+      rest.remove_prefix(rest.starts_with(">>") ? 2 : 1);
+      if (rest.starts_with('|'))
+        rest.remove_prefix(1);
+      if (rest.starts_with('&')) // `>&2` duplicates a descriptor
+        continue;
+      if (!rest.empty())
+        add(std::string(rest));
+      else if (i + 1 < words.size())
+        add(words[++i]);
+    }
+
+    // Skip variable assignments and wrappers in front of the command.
+    std::size_t first = 0;
+    while (first < args.size() &&
+           (args[first].find('=') != std::string::npos ||
+            args[first] == "sudo" || args[first] == "command" ||
+            args[first] == "env"))
+      ++first;
+    if (first == args.size())
+      continue;
+    std::string name = fs::path(args[first]).filename().string();
+    std::vector<std::string> operands;
+    bool in_place = false;
+    bool has_script = false;
+    for (std::size_t i = first + 1; i < args.size(); ++i) {
+      const std::string &a = args[i];
+      if (!is_option(a)) {
+        operands.push_back(a);
+        continue;
+      }
+      if ((name == "sed" && (a.starts_with("-i") || a == "--in-place")) ||
+          (name == "perl" && a.find('i') != std::string::npos &&
+           !a.starts_with("--")))
+        in_place = true;
+      // Options whose value is the next word.
+      if (((name == "sed" || name == "perl") &&
+           (a == "-e" || a == "-f" || a.ends_with("e"))) ||
+          (name == "truncate" && (a == "-s" || a == "-r"))) {
+        has_script |= name != "truncate";
+        ++i;
+      }
+    }
+
+    if (name == "tee" || name == "rm" || name == "touch" ||
+        name == "truncate") {
+      for (const auto &op : operands)
+        add(op);
+    } else if ((name == "sed" || name == "perl") && in_place) {
+      for (std::size_t i = has_script ? 0 : 1; i < operands.size(); ++i)
+        add(operands[i]);
+    } else if ((name == "mv" || name == "cp") && operands.size() >= 2) {
+      const std::string &dest = operands.back();
+      std::error_code ec;
+      bool into_dir = fs::is_directory(dest, ec);
+      for (std::size_t i = 0; i + 1 < operands.size(); ++i) {
+        if (name == "mv")
+          add(operands[i]);
+        add(into_dir ? (fs::path(dest) / fs::path(operands[i]).filename())
+                           .string()
+                     : dest);
+      }
+    }
+  }
+  return paths;
+}
+
+} // namespace agent
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace agent {
+
+// Per-turn workspace checkpoints. Before a tool mutates a file its current
+// contents are saved once per checkpoint, as a reflink (copy-on-write clone)
+// where the filesystem supports it and a plain copy otherwise; files that did
+// not exist yet are remembered as absent. Undo moves the saved images back
+// with rename(2) and deletes files the turn created, so it costs one rename
+// or unlink per touched file no matter how large the files are.
+class Checkpoints {
+public:
+  // Saved images live under `dir`, which should be on the same filesystem
+  // as the workspace for reflinks and renames to work.
+  explicit Checkpoints(std::filesystem::path dir);
+  ~Checkpoints();
+  Checkpoints(const Checkpoints &) = delete;
+  Checkpoints &operator=(const Checkpoints &) = delete;
+
+  // Starts a new checkpoint; empty checkpoints are reused.
+  void begin(std::string label);
+
+  // Saves `path` (a file, or the files under a directory) into the current
+  // checkpoint unless it is already there.
+  void record(const std::filesystem::path &path);
+
+  struct Undone {
+    std::string label;
+    std::vector<std::string> files;
+  };
+  // Restores the workspace to its state before the last `n` checkpoints
+  // that touched files, newest first.
+  std::vector<Undone> undo(std::size_t n);
+
+  // Checkpoints that can be undone.
+  std::size_t size() const;
+
+private:
+  struct Entry {
+    std::filesystem::path path;
+    // Empty when the file did not exist before the checkpoint.
+    std::filesystem::path saved;
+  };
+  struct Checkpoint {
+    std::string label;
+    std::vector<Entry> entries;
+    std::unordered_set<std::string> seen;
+  };
+
+  void record_file(const std::filesystem::path &path);
+
+  std::filesystem::path dir_;
+  std::vector<Checkpoint> stack_;
+  std::size_t next_id_ = 0;
+};
+
+// Best-effort list of files a shell command writes, renames or deletes:
+// redirection targets, `tee`, `sed -i`/`perl -i`, `rm`, `mv`, `cp`,
+// `touch` and `truncate` operands. Used to checkpoint them before `bash`
+// runs.
+std::vector<std::string> bash_mutations(std::string_view cmd);
+
+} // namespace agent
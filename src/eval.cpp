@@ -0,0 +1,748 @@
+#include "eval.hpp"
+#include "output.hpp"
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/io_context.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace eval {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+struct Task {
+  std::string name;
+  std::string prompt;
+  std::string verify;
+  std::string replay;
+  std::string model;
+};
+
+struct Suite {
+  fs::path repo;
+  std::string base = "HEAD";
+  unsigned max_turns = 50;
+  std::vector<Task> tasks;
+};
+
+struct TaskResult {
+  bool completed = false;
+  bool passed = false;
+  bool crashed = true;
+  unsigned turns = 0;
+  std::uint64_t input_tokens = 0;
+  std::uint64_t output_tokens = 0;
+  double wall_seconds = 0;
+  std::string error;
+};
+
+std::string quote(const std::string &s) {
+  std::string out = "'";
+  for (char c : s) {
+    if (c == '\'')
+      out += "'\\''";
+    else
+      out += c;
+  }
+  return out + "'";
+}
+
+// Runs `cmd` through the shell, returning its exit status and combined
+// output.
+int run_command(const std::string &cmd, std::string &output) {
+  FILE *fp = popen((cmd + " 2>&1").c_str(), "r");
+  if (!fp)
+    return -1;
+  char buffer[4096];
+  std::size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+    output.append(buffer, n);
+  int status = pclose(fp);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+std::string string_field(const boost::json::object &obj,
+                         boost::json::string_view key) {
+  if (auto *v = obj.if_contains(key); v && v->is_string())
+    return std::string(v->get_string().data(), v->get_string().size());
+  return {};
+}
+
+std::expected<Suite, std::string> load_suite(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return std::unexpected("cannot open " + path);
+  std::string text((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  boost::system::error_code ec;
+  boost::json::value root = boost::json::parse(text, ec);
+  if (ec || !root.is_object())
+    return std::unexpected(path + " is not a JSON object");
+  const auto &obj = root.get_object();
+
+  // Relative paths in the suite are relative to the suite file.
+  fs::path dir = fs::absolute(path).parent_path();
+  Suite suite;
+  std::string repo = string_field(obj, "repo");
+  suite.repo = fs::weakly_canonical(dir / (repo.empty() ? "." : repo));
+  if (std::string base = string_field(obj, "base"); !base.empty())
+    suite.base = std::move(base);
+  if (auto *turns = obj.if_contains("max_turns"); turns && turns->is_int64())
+    suite.max_turns = static_cast<unsigned>(turns->get_int64());
+
+  auto *tasks = obj.if_contains("tasks");
+  if (!tasks || !tasks->is_array())
+    return std::unexpected(path + " has no \"tasks\" array");
+  for (const auto &value : tasks->get_array()) {
+    if (!value.is_object())
+      continue;
+    const auto &t = value.get_object();
+    Task task{string_field(t, "name"), string_field(t, "prompt"),
+              string_field(t, "verify"), string_field(t, "replay"),
+              string_field(t, "model")};
+    if (task.prompt.empty())
+      return std::unexpected("task " + std::to_string(suite.tasks.size()) +
+                             " has no prompt");
+    if (task.name.empty())
+      task.name = "task-" + std::to_string(suite.tasks.size());
+    if (!task.replay.empty())
+      task.replay = (dir / task.replay).string();
+    suite.tasks.push_back(std::move(task));
+  }
+  return suite;
+}
+
+boost::json::object task_to_json(const Task &task) {
+  return {{"name", task.name},
+          {"prompt", task.prompt},
+          {"verify", task.verify},
+          {"replay", task.replay},
+          {"model", task.model}};
+}
+
+Task task_from_json(const boost::json::object &obj) {
+  return {string_field(obj, "name"), string_field(obj, "prompt"),
+          string_field(obj, "verify"), string_field(obj, "replay"),
+          string_field(obj, "model")};
+}
+
+// Newline-delimited JSON over a stream socket.
+bool send_message(int fd, const boost::json::object &message) {
+  std::string line = boost::json::serialize(message);
+  line += '\n';
+  std::size_t done = 0;
+  while (done < line.size()) {
+    // MSG_NOSIGNAL: a dead peer is reported as an error, not SIGPIPE.
+    ssize_t n =
+        ::send(fd, line.data() + done, line.size() - done, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    done += static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+// Reads whatever is available on `fd` into `buffer` and moves complete
+// messages into `messages`. Returns false on EOF or error.
+bool read_messages(int fd, std::string &buffer,
+                   std::vector<boost::json::object> &messages) {
+  char chunk[4096];
+  ssize_t n = ::read(fd, chunk, sizeof(chunk));
+  if (n < 0 && errno == EINTR)
+    return true;
+  if (n <= 0)
+    return false;
+  buffer.append(chunk, static_cast<std::size_t>(n));
+  std::size_t pos;
+  while ((pos = buffer.find('\n')) != std::string::npos) {
+    boost::system::error_code ec;
+    boost::json::value value =
+        boost::json::parse(std::string_view(buffer.data(), pos), ec);
+    buffer.erase(0, pos + 1);
+    if (!ec && value.is_object())
+      messages.push_back(std::move(value.get_object()));
+  }
+  return true;
+}
+
+// Runs one task inside `worktree`, logging to `log_path`. The worker's
+// stdout and stderr point at the log for the duration of the job.
+boost::json::object run_job(const Task &task, agent::AgentConfig config,
+                            unsigned max_turns, const std::string &worktree,
+                            const std::string &log_path) {
+  std::cout.flush();
+  int log = ::open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (log >= 0) {
+    ::dup2(log, STDOUT_FILENO);
+    ::dup2(log, STDERR_FILENO);
+    ::close(log);
+  }
+
+  boost::json::object result;
+  if (::chdir(worktree.c_str()) != 0) {
+    result["error"] = "cannot enter worktree";
+    return result;
+  }
+  // A shared --replay would carry its position over from the previous task.
+  if (const std::string &path =
+          task.replay.empty() ? config.replay_path : task.replay;
+      !path.empty()) {
+    auto replay = llm::Replay::load(path);
+    if (!replay) {
+      result["error"] = replay.error();
+      return result;
+    }
+    config.replay = std::make_shared<llm::Replay>(std::move(*replay));
+  }
+  if (!config.record_path.empty()) {
+    // A retry starts the task's recording over.
+    fs::path dir = config.record_path;
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    config.record_path = (dir / (task.name + ".jsonl")).string();
+    fs::remove(config.record_path, ec);
+  }
+  if (!task.model.empty())
+    config.initial_model = task.model;
+  config.max_turns = max_turns;
+  // Saves from eval runs would only pollute the search index.
+  config.session_index_path.clear();
+
+  std::cout << "⏺ " << task.name << ": " << task.prompt << "\n";
+  bool completed = false;
+  agent::SessionStats stats;
+  {
+    boost::asio::io_context ioc;
+    agent::Agent agent(config);
+    boost::asio::co_spawn(ioc, agent.run_task(task.prompt),
+                          [&](std::exception_ptr e, bool ok) {
+                            completed = !e && ok;
+                          });
+    ioc.run();
+    term::out().detach();
+    stats = agent.stats();
+  }
+
+  bool passed = completed;
+  if (completed && !task.verify.empty()) {
+    std::string output;
+    int status = run_command(task.verify, output);
+    std::cout << "\n⏺ verify: " << task.verify << " (exit " << status
+              << ")\n"
+              << output;
+    passed = status == 0;
+  }
+  std::cout.flush();
+
+  result["completed"] = completed;
+  result["passed"] = passed;
+  result["turns"] = stats.main_turns + stats.fast_turns;
+  result["input_tokens"] = stats.input_tokens;
+  result["output_tokens"] = stats.output_tokens;
+  return result;
+}
+
+TaskResult parse_result(const boost::json::object &obj) {
+  TaskResult result;
+  result.error = string_field(obj, "error");
+  if (!result.error.empty())
+    return result;
+  result.crashed = false;
+  auto number = [&](boost::json::string_view key) -> std::uint64_t {
+    auto *v = obj.if_contains(key);
+    if (v && v->is_uint64())
+      return v->get_uint64();
+    if (v && v->is_int64() && v->get_int64() > 0)
+      return static_cast<std::uint64_t>(v->get_int64());
+    return 0;
+  };
+  auto flag = [&](boost::json::string_view key) {
+    auto *v = obj.if_contains(key);
+    return v && v->is_bool() && v->get_bool();
+  };
+  result.completed = flag("completed");
+  result.passed = flag("passed");
+  result.turns = static_cast<unsigned>(number("turns"));
+  result.input_tokens = number("input_tokens");
+  result.output_tokens = number("output_tokens");
+  return result;
+}
+
+using steady = std::chrono::steady_clock;
+
+struct Job {
+  std::size_t task;
+  unsigned attempt = 0;
+};
+
+// One worker process as seen by the coordinator. Jobs are sharded
+// round-robin into each worker's deque up front; a worker takes from the
+// front of its own shard and, once that is empty, steals from the back of
+// the longest other shard.
+struct Worker {
+  pid_t pid = -1;
+  int fd = -1;
+  std::string buffer;
+  std::deque<Job> shard;
+  std::optional<Job> running;
+  fs::path worktree;
+  steady::time_point started;
+  unsigned done = 0;
+  unsigned stolen = 0;
+  double busy_seconds = 0;
+};
+
+// Close-on-exec so workers don't inherit each other's connections.
+int unix_socket() {
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0)
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+}
+
+pid_t spawn_worker(const std::string &self, const std::string &socket_path,
+                   const std::vector<std::string> &args) {
+  std::vector<char *> argv{const_cast<char *>(self.c_str()),
+                           const_cast<char *>("--worker"),
+                           const_cast<char *>(socket_path.c_str())};
+  for (const auto &arg : args)
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  argv.push_back(nullptr);
+  std::cout.flush();
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    ::execv(self.c_str(), argv.data());
+    ::_exit(127);
+  }
+  return pid;
+}
+
+} // namespace
+
+int run_worker(const std::string &socket_path,
+               const agent::AgentConfig &base) {
+  int fd = unix_socket();
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (fd < 0 || socket_path.size() >= sizeof(addr.sun_path))
+    return EXIT_FAILURE;
+  std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    return EXIT_FAILURE;
+  if (!send_message(fd, {{"type", "hello"}, {"pid", ::getpid()}}))
+    return EXIT_FAILURE;
+
+  std::string buffer;
+  std::vector<boost::json::object> messages;
+  while (read_messages(fd, buffer, messages)) {
+    for (const auto &message : messages) {
+      if (string_field(message, "type") != "job")
+        return EXIT_SUCCESS;
+      const auto *task = message.if_contains("task");
+      const auto *turns = message.if_contains("max_turns");
+      boost::json::object result = run_job(
+          task && task->is_object() ? task_from_json(task->get_object())
+                                    : Task{},
+          base,
+          turns && turns->is_int64() ? static_cast<unsigned>(turns->get_int64())
+                                     : 0,
+          string_field(message, "worktree"), string_field(message, "log"));
+      result["type"] = "result";
+      if (!send_message(fd, result))
+        return EXIT_FAILURE;
+    }
+    messages.clear();
+  }
+  return EXIT_SUCCESS;
+}
+
+int run_suite(const std::string &suite_path, const agent::AgentConfig &base,
+              const EvalOptions &options) {
+  auto suite = load_suite(suite_path);
+  if (!suite) {
+    std::cerr << "eval: " << suite.error() << "\n";
+    return EXIT_FAILURE;
+  }
+
+  fs::path root = fs::temp_directory_path() /
+                  ("nanocode-eval-" + std::to_string(::getpid()));
+  fs::create_directories(root);
+  std::string socket_path = (root / "coordinator.sock").string();
+
+  int listener = unix_socket();
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (listener < 0 || socket_path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "eval: cannot create " << socket_path << "\n";
+    return EXIT_FAILURE;
+  }
+  std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+  if (::bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) !=
+          0 ||
+      ::listen(listener, 128) != 0) {
+    std::cerr << "eval: cannot listen on " << socket_path << "\n";
+    return EXIT_FAILURE;
+  }
+
+  std::size_t worker_count =
+      std::min<std::size_t>(options.jobs, std::max<std::size_t>(
+                                              suite->tasks.size(), 1));
+  std::cout << "eval: " << suite->tasks.size() << " tasks from "
+            << suite->repo.string() << " @ " << suite->base << " on "
+            << worker_count << " workers, logs in " << root.string() << "\n";
+
+  std::vector<Worker> workers(worker_count);
+  for (std::size_t i = 0; i < suite->tasks.size(); ++i)
+    workers[i % worker_count].shard.push_back({i});
+  for (auto &w : workers)
+    w.pid = spawn_worker(options.self_path, socket_path, options.worker_args);
+
+  std::vector<TaskResult> results(suite->tasks.size());
+  std::size_t finished = 0;
+  unsigned retries = 0;
+  unsigned respawns = 0;
+  std::vector<int> unidentified;
+  auto start_all = steady::now();
+
+  auto remove_worktree = [&](const fs::path &worktree) {
+    if (options.keep_worktrees || worktree.empty())
+      return;
+    std::string output;
+    run_command("git -C " + quote(suite->repo.string()) +
+                    " worktree remove --force " + quote(worktree.string()),
+                output);
+  };
+
+  auto finish = [&](std::size_t task, TaskResult result) {
+    const Task &t = suite->tasks[task];
+    std::cout << (result.passed ? "PASS " : "FAIL ") << t.name << " ("
+              << std::fixed << std::setprecision(1) << result.wall_seconds
+              << "s, " << result.turns << " turns)"
+              << (result.error.empty() ? "" : " " + result.error) << "\n";
+    results[task] = std::move(result);
+    ++finished;
+  };
+
+  // Failed infrastructure (a crash, a provider error) is retried on the
+  // worker with the shortest shard; a failing verify command is a result.
+  auto retry_or_finish = [&](Job job, TaskResult result) {
+    bool failed = result.crashed || !result.completed;
+    if (failed && job.attempt < options.retries) {
+      ++retries;
+      ++job.attempt;
+      // Live workers first, then the shortest shard.
+      auto target = std::min_element(
+          workers.begin(), workers.end(), [](const Worker &a, const Worker &b) {
+            if ((a.pid < 0) != (b.pid < 0))
+              return a.pid >= 0;
+            return a.shard.size() < b.shard.size();
+          });
+      target->shard.push_back(job);
+      return;
+    }
+    finish(job.task, std::move(result));
+  };
+
+  auto next_job = [&](Worker &w) -> std::optional<Job> {
+    if (!w.shard.empty()) {
+      Job job = w.shard.front();
+      w.shard.pop_front();
+      return job;
+    }
+    auto victim = std::max_element(
+        workers.begin(), workers.end(), [](const Worker &a, const Worker &b) {
+          return a.shard.size() < b.shard.size();
+        });
+    if (victim->shard.empty())
+      return std::nullopt;
+    Job job = victim->shard.back();
+    victim->shard.pop_back();
+    ++w.stolen;
+    return job;
+  };
+
+  auto dispatch = [&](Worker &w) {
+    while (!w.running && w.fd >= 0) {
+      auto job = next_job(w);
+      if (!job)
+        return;
+      const Task &task = suite->tasks[job->task];
+      std::string stem = std::to_string(job->task) + "-" + task.name;
+      if (job->attempt)
+        stem += "-retry" + std::to_string(job->attempt);
+      // Worktrees are created here, one at a time, because concurrent
+      // `git worktree add` calls contend for the repository lock.
+      fs::path worktree = root / stem;
+      std::string output;
+      if (run_command("git -C " + quote(suite->repo.string()) +
+                          " worktree add --detach " + quote(worktree.string()) +
+                          " " + quote(suite->base),
+                      output) != 0) {
+        TaskResult result;
+        result.error = "git worktree add failed: " + output;
+        finish(job->task, std::move(result));
+        continue;
+      }
+      boost::json::object message{
+          {"type", "job"},
+          {"task", task_to_json(task)},
+          {"max_turns", suite->max_turns},
+          {"worktree", worktree.string()},
+          {"log", (root / (stem + ".log")).string()}};
+      w.running = job;
+      w.worktree = worktree;
+      w.started = steady::now();
+      if (!send_message(w.fd, message))
+        return; // the hangup is handled by the poll loop
+    }
+  };
+
+  // A worker that exited or hung up: its in-flight job is retried and a
+  // replacement is started while there is work left.
+  auto lose_worker = [&](Worker &w) {
+    if (w.fd >= 0)
+      ::close(w.fd);
+    w.fd = -1;
+    if (w.pid > 0)
+      ::waitpid(w.pid, nullptr, 0);
+    w.pid = -1;
+    if (w.running) {
+      remove_worktree(w.worktree);
+      TaskResult result;
+      result.error = "worker died";
+      result.wall_seconds =
+          std::chrono::duration<double>(steady::now() - w.started).count();
+      Job job = *w.running;
+      w.running.reset();
+      retry_or_finish(job, std::move(result));
+    }
+    if (finished < results.size() && respawns < 2 * worker_count) {
+      ++respawns;
+      w.pid = spawn_worker(options.self_path, socket_path, options.worker_args);
+    } else {
+      // Nobody will take these; hand them to the surviving workers.
+      for (auto &other : workers)
+        if (other.pid > 0)
+          while (!w.shard.empty()) {
+            other.shard.push_back(w.shard.front());
+            w.shard.pop_front();
+          }
+    }
+  };
+
+  while (finished < results.size()) {
+    std::vector<pollfd> fds{{listener, POLLIN, 0}};
+    for (int fd : unidentified)
+      fds.push_back({fd, POLLIN, 0});
+    for (auto &w : workers)
+      if (w.fd >= 0)
+        fds.push_back({w.fd, POLLIN, 0});
+    if (::poll(fds.data(), fds.size(), 1000) < 0 && errno != EINTR)
+      break;
+
+    // Workers that died before connecting never show up on a socket. One
+    // that exited on its own could not start with these settings, and a
+    // replacement would fail the same way.
+    bool setup_failed = false;
+    for (auto &w : workers) {
+      int status = 0;
+      if (w.pid > 0 && w.fd < 0 &&
+          ::waitpid(w.pid, &status, WNOHANG) == w.pid) {
+        w.pid = -1;
+        if (WIFEXITED(status)) {
+          std::cerr << "eval: a worker exited with status "
+                    << WEXITSTATUS(status) << " before connecting\n";
+          setup_failed = true;
+          break;
+        }
+        lose_worker(w);
+        for (auto &other : workers)
+          dispatch(other);
+      }
+    }
+    if (setup_failed)
+      break;
+    if (std::none_of(workers.begin(), workers.end(),
+                     [](const Worker &w) { return w.pid > 0; })) {
+      std::cerr << "eval: no workers left\n";
+      break;
+    }
+
+    for (const pollfd &p : fds) {
+      if (!p.revents)
+        continue;
+      if (p.fd == listener) {
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd >= 0) {
+          ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+          unidentified.push_back(fd);
+        }
+        continue;
+      }
+
+      auto pending = std::find(unidentified.begin(), unidentified.end(), p.fd);
+      auto worker = std::find_if(workers.begin(), workers.end(),
+                                 [&](const Worker &w) { return w.fd == p.fd; });
+      std::string scratch;
+      std::string &buffer = worker != workers.end() ? worker->buffer : scratch;
+      std::vector<boost::json::object> messages;
+      bool open = read_messages(p.fd, buffer, messages);
+
+      if (pending != unidentified.end()) {
+        // The hello message maps a connection to the process we spawned.
+        unidentified.erase(pending);
+        pid_t pid = 0;
+        if (!messages.empty())
+          if (auto *v = messages.front().if_contains("pid"); v && v->is_int64())
+            pid = static_cast<pid_t>(v->get_int64());
+        auto owner = std::find_if(
+            workers.begin(), workers.end(),
+            [&](const Worker &w) { return w.pid == pid && w.fd < 0; });
+        if (!open || owner == workers.end()) {
+          ::close(p.fd);
+          continue;
+        }
+        owner->fd = p.fd;
+        dispatch(*owner);
+        continue;
+      }
+      if (worker == workers.end())
+        continue;
+
+      for (const auto &message : messages) {
+        if (string_field(message, "type") != "result" || !worker->running)
+          continue;
+        TaskResult result = parse_result(message);
+        double seconds =
+            std::chrono::duration<double>(steady::now() - worker->started)
+                .count();
+        result.wall_seconds = seconds;
+        worker->busy_seconds += seconds;
+        ++worker->done;
+        remove_worktree(worker->worktree);
+        Job job = *worker->running;
+        worker->running.reset();
+        retry_or_finish(job, std::move(result));
+      }
+      if (!open)
+        lose_worker(*worker);
+      // Retries may have landed on idle workers; let everyone pull.
+      for (auto &w : workers)
+        dispatch(w);
+    }
+  }
+
+  for (auto &w : workers) {
+    if (w.fd >= 0) {
+      send_message(w.fd, {{"type", "shutdown"}});
+      ::close(w.fd);
+    } else if (w.pid > 0) {
+      // Still starting up after the run was stopped.
+      ::kill(w.pid, SIGTERM);
+    }
+    if (w.pid > 0)
+      ::waitpid(w.pid, nullptr, 0);
+  }
+  for (int fd : unidentified)
+    ::close(fd);
+  ::close(listener);
+  ::unlink(socket_path.c_str());
+  double total_seconds =
+      std::chrono::duration<double>(steady::now() - start_all).count();
+
+  std::size_t passed = 0;
+  std::uint64_t input_tokens = 0;
+  std::uint64_t output_tokens = 0;
+  boost::json::array report;
+  std::cout << "\n"
+            << std::left << std::setw(24) << "task" << std::right
+            << std::setw(6) << "pass" << std::setw(9) << "wall s"
+            << std::setw(7) << "turns" << std::setw(11) << "in tok"
+            << std::setw(10) << "out tok" << "\n";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const Task &task = suite->tasks[i];
+    const TaskResult &r = results[i];
+    passed += r.passed;
+    input_tokens += r.input_tokens;
+    output_tokens += r.output_tokens;
+    std::cout << std::left << std::setw(24) << task.name << std::right
+              << std::setw(6) << (r.passed ? "yes" : "no") << std::setw(9)
+              << std::fixed << std::setprecision(1) << r.wall_seconds
+              << std::setw(7) << r.turns << std::setw(11) << r.input_tokens
+              << std::setw(10) << r.output_tokens << "\n";
+    report.push_back({{"name", task.name},
+                      {"passed", r.passed},
+                      {"completed", r.completed},
+                      {"crashed", r.crashed},
+                      {"wall_seconds", r.wall_seconds},
+                      {"turns", r.turns},
+                      {"input_tokens", r.input_tokens},
+                      {"output_tokens", r.output_tokens},
+                      {"error", r.error}});
+  }
+
+  boost::json::array worker_report;
+  double busy = 0;
+  std::cout << "\n";
+  for (std::size_t i = 0; i < workers.size(); ++i) {
+    const Worker &w = workers[i];
+    busy += w.busy_seconds;
+    std::cout << "worker " << i << ": " << w.done << " jobs (" << w.stolen
+              << " stolen), busy " << std::setprecision(1) << w.busy_seconds
+              << "s\n";
+    worker_report.push_back({{"jobs", w.done},
+                             {"stolen", w.stolen},
+                             {"busy_seconds", w.busy_seconds}});
+  }
+  double utilization =
+      total_seconds > 0 ? busy / (total_seconds * workers.size()) : 0;
+  std::cout << "\npassed " << passed << "/" << results.size() << " ("
+            << std::setprecision(0)
+            << (results.empty() ? 0.0 : 100.0 * passed / results.size())
+            << "%) in " << std::setprecision(1) << total_seconds << "s, "
+            << retries << " retries, " << std::setprecision(0)
+            << utilization * 100 << "% worker utilization, " << input_tokens
+            << " in / " << output_tokens << " out tokens\n";
+
+  std::ofstream(root / "report.json")
+      << boost::json::serialize(boost::json::object{
+             {"suite", suite_path},
+             {"base", suite->base},
+             {"passed", passed},
+             {"total", results.size()},
+             {"wall_seconds", total_seconds},
+             {"retries", retries},
+             {"utilization", utilization},
+             {"input_tokens", input_tokens},
+             {"output_tokens", output_tokens},
+             {"workers", std::move(worker_report)},
+             {"tasks", std::move(report)}})
+      << "\n";
+  std::cout << "report: " << (root / "report.json").string() << "\n";
+  return passed == results.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace eval
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "agent.hpp"
+#include <string>
+#include <vector>
+
+namespace eval {
+
+struct EvalOptions {
+  // Worker processes; each runs one task at a time in its own worktree.
+  unsigned jobs = 4;
+  // Extra attempts for tasks whose worker died or whose agent loop failed.
+  unsigned retries = 1;
+  // Leave the worktrees in place for inspection.
+  bool keep_worktrees = false;
+  // Executable started for each worker (with --worker <socket>).
+  std::string self_path;
+  // Settings flags passed on to each worker after --worker <socket>, so it
+  // builds the same AgentConfig as the coordinator.
+  std::vector<std::string> worker_args;
+};
+
+// Runs the task suite described in `suite_path` on a local coordinator that
+// shards the tasks across `jobs` worker processes over a Unix socket:
+//
+//   {"repo": ".", "base": "HEAD", "max_turns": 50,
+//    "tasks": [{"name": "fix-tls", "prompt": "...", "verify": "make test",
+//               "replay": "fix-tls.jsonl", "model": "..."}]}
+//
+// Each task gets a detached worktree of `repo` at `base`, an Agent scoped
+// to it, and then its `verify` command; exit status 0 is a pass. `replay`
+// (relative to the suite file) makes a task run offline from responses
+// recorded with --record; a task without one replays --replay, if given,
+// from its start. In an eval run, --record names a directory that
+// gets one <task name>.jsonl per task. Idle workers steal queued tasks from
+// busy ones, and tasks lost to a crash or a provider error are retried. A
+// worker that exits before connecting (bad settings, an unreadable
+// --replay) stops the run. Prints per-task wall time, turns, tokens and
+// the pass rate plus per-worker load, and writes the same as report.json
+// next to the worktrees. Returns the process exit code.
+int run_suite(const std::string &suite_path, const agent::AgentConfig &base,
+              const EvalOptions &options);
+
+// Worker side: connects to the coordinator at `socket_path` and runs the
+// tasks it is handed until told to stop.
+int run_worker(const std::string &socket_path, const agent::AgentConfig &base);
+
+} // namespace eval
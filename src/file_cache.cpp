@@ -0,0 +1,300 @@
+#include "file_cache.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <sys/stat.h>
+
+namespace fs = std::filesystem;
+
+namespace tools {
+
+namespace {
+
+// Prefetching is for source files; anything bigger is left to a real read.
+constexpr std::uint64_t max_prefetch_size = 1024 * 1024;
+constexpr std::size_t max_candidates = 16;
+
+std::string normalize(const std::string &path) {
+  return fs::path(path).lexically_normal().string();
+}
+
+} // namespace
+
+bool stat_file(const std::string &path, FileStamp &stamp) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+#if defined(__APPLE__)
+  const auto &mtime = st.st_mtimespec;
+#else
+  const auto &mtime = st.st_mtim;
+#endif
+  stamp.size = static_cast<std::uint64_t>(st.st_size);
+  stamp.mtime_ns = static_cast<std::int64_t>(mtime.tv_sec) * 1000000000 +
+                   mtime.tv_nsec;
+  stamp.inode = static_cast<std::uint64_t>(st.st_ino);
+  return true;
+}
+
+FileCache::FileCache(std::size_t capacity_bytes) : capacity_(capacity_bytes) {}
+
+FileCache::~FileCache() {
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+  queue_cv_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+std::shared_ptr<const std::string> FileCache::load(const std::string &path,
+                                                   std::uint64_t size) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return nullptr;
+  auto content = std::make_shared<std::string>();
+  content->resize(size);
+  in.read(content->data(), static_cast<std::streamsize>(size));
+  // The file may have changed size between stat and read.
+  content->resize(static_cast<std::size_t>(in.gcount()));
+  return content;
+}
+
+std::shared_ptr<const std::string> FileCache::read(const std::string &path) {
+  std::string key = normalize(path);
+  FileStamp stamp;
+  if (!stat_file(key, stamp))
+    return nullptr;
+  {
+    std::lock_guard lock(mutex_);
+    if (auto it = entries_.find(key);
+        it != entries_.end() && it->second.stamp == stamp) {
+      ++stats_.hits;
+      if (it->second.prefetched) {
+        ++stats_.prefetch_hits;
+        it->second.prefetched = false;
+      }
+      lru_.splice(lru_.begin(), lru_, it->second.lru);
+      return it->second.content;
+    }
+    ++stats_.misses;
+  }
+  auto content = load(key, stamp.size);
+  if (content)
+    insert(key, content, stamp, false);
+  return content;
+}
+
+void FileCache::insert(const std::string &key,
+                       std::shared_ptr<const std::string> content,
+                       const FileStamp &stamp, bool prefetched) {
+  std::lock_guard lock(mutex_);
+  if (content->size() > capacity_)
+    return;
+  if (auto it = entries_.find(key); it != entries_.end()) {
+    stats_.bytes -= it->second.content->size();
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+  }
+  lru_.push_front(key);
+  stats_.bytes += content->size();
+  entries_.emplace(key, Entry{std::move(content), stamp, prefetched,
+                              lru_.begin()});
+  evict_locked(capacity_);
+}
+
+void FileCache::evict_locked(std::size_t limit) {
+  while (stats_.bytes > limit && !lru_.empty()) {
+    auto it = entries_.find(lru_.back());
+    stats_.bytes -= it->second.content->size();
+    entries_.erase(it);
+    lru_.pop_back();
+  }
+}
+
+void FileCache::invalidate(const std::string &path) {
+  std::string key = normalize(path);
+  std::lock_guard lock(mutex_);
+  if (auto it = entries_.find(key); it != entries_.end()) {
+    stats_.bytes -= it->second.content->size();
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+  }
+}
+
+void FileCache::prefetch(std::vector<std::string> paths) {
+  {
+    std::lock_guard lock(mutex_);
+    for (auto &path : paths) {
+      std::string key = normalize(path);
+      if (entries_.contains(key) || !queued_.insert(key).second)
+        continue;
+      queue_.push_back(std::move(key));
+    }
+    if (queue_.empty())
+      return;
+    if (!thread_.joinable())
+      thread_ = std::thread([this] { worker(); });
+  }
+  queue_cv_.notify_one();
+}
+
+void FileCache::worker() {
+  std::unique_lock lock(mutex_);
+  while (true) {
+    queue_cv_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+    if (stopping_)
+      return;
+    std::string key = std::move(queue_.front());
+    queue_.pop_front();
+    queued_.erase(key);
+
+    lock.unlock();
+    FileStamp stamp;
+    std::shared_ptr<const std::string> content;
+    if (stat_file(key, stamp) && stamp.size <= max_prefetch_size)
+      content = load(key, stamp.size);
+    if (content) {
+      insert(key, std::move(content), stamp, true);
+      std::lock_guard count(mutex_);
+      ++stats_.prefetched;
+    }
+    lock.lock();
+  }
+}
+
+void FileCache::set_capacity(std::size_t bytes) {
+  std::lock_guard lock(mutex_);
+  capacity_ = bytes;
+  evict_locked(capacity_);
+}
+
+void FileCache::shrink_to(std::size_t bytes) {
+  std::lock_guard lock(mutex_);
+  evict_locked(bytes);
+}
+
+FileCacheStats FileCache::stats() const {
+  std::lock_guard lock(mutex_);
+  FileCacheStats s = stats_;
+  s.entries = entries_.size();
+  return s;
+}
+
+FileCache &file_cache() {
+  static FileCache cache;
+  return cache;
+}
+
+std::vector<std::string> prefetch_candidates(const std::string &path,
+                                             std::string_view content) {
+  std::vector<std::string> out;
+  fs::path file(path);
+  fs::path dir = file.parent_path();
+  std::string stem = file.stem().string();
+  std::string ext = file.extension().string();
+  auto add = [&](const fs::path &p) {
+    if (out.size() < max_candidates)
+      out.push_back(p.lexically_normal().string());
+  };
+
+  bool c_like = ext == ".c" || ext == ".cc" || ext == ".cpp" ||
+                ext == ".cxx" || ext == ".h" || ext == ".hh" ||
+                ext == ".hpp" || ext == ".hxx";
+  bool python = ext == ".py";
+  bool js = ext == ".js" || ext == ".jsx" || ext == ".ts" || ext == ".tsx" ||
+            ext == ".mjs";
+  bool rust = ext == ".rs";
+
+  // Scan line by line; only the first few hundred lines hold imports.
+  std::size_t pos = 0;
+  for (int lines = 0; pos < content.size() && lines < 400; ++lines) {
+    std::size_t end = content.find('\n', pos);
+    if (end == std::string_view::npos)
+      end = content.size();
+    std::string_view line = content.substr(pos, end - pos);
+    pos = end + 1;
+    while (!line.empty() && (line.front() == ' ' || line.front() == '\t'))
+      line.remove_prefix(1);
+
+    if (c_like && line.starts_with("#")) {
+      // `#include "local.h"`; system headers in <> are not ours.
+      std::size_t q = line.find('"');
+      if (line.find("include") == std::string_view::npos ||
+          q == std::string_view::npos)
+        continue;
+      std::size_t q2 = line.find('"', q + 1);
+      if (q2 == std::string_view::npos)
+        continue;
+      fs::path inc(line.substr(q + 1, q2 - q - 1));
+      add(dir / inc);
+      add(fs::path("include") / inc);
+      add(fs::path("src") / inc);
+    } else if (python &&
+               (line.starts_with("import ") || line.starts_with("from "))) {
+      std::string_view module = line.substr(line.find(' ') + 1);
+      module = module.substr(0, module.find_first_of(" ,;"));
+      bool relative = module.starts_with('.');
+      while (module.starts_with('.'))
+        module.remove_prefix(1);
+      std::string rel(module);
+      for (char &c : rel)
+        if (c == '.')
+          c = '/';
+      if (rel.empty())
+        continue;
+      fs::path base = relative ? dir : fs::path();
+      add(base / (rel + ".py"));
+      add(base / rel / "__init__.py");
+    } else if (js && (line.starts_with("import ") ||
+                      line.find("require(") != std::string_view::npos)) {
+      // Only relative specifiers name files in this repository.
+      std::size_t from = line.find("from ");
+      std::size_t q = line.find_first_of(
+          "'\"", from == std::string_view::npos ? 0 : from);
+      if (q == std::string_view::npos)
+        continue;
+      std::size_t q2 = line.find(line[q], q + 1);
+      if (q2 == std::string_view::npos)
+        continue;
+      std::string_view spec = line.substr(q + 1, q2 - q - 1);
+      if (!spec.starts_with("./") && !spec.starts_with("../"))
+        continue;
+      fs::path target = dir / spec;
+      if (target.has_extension()) {
+        add(target);
+        continue;
+      }
+      for (const char *e : {".ts", ".tsx", ".js", ".jsx"})
+        add(fs::path(target.string() + e));
+      add(target / "index.ts");
+      add(target / "index.js");
+    } else if (rust && line.starts_with("mod ") && line.ends_with(";")) {
+      std::string name(line.substr(4, line.size() - 5));
+      add(dir / (name + ".rs"));
+      add(dir / name / "mod.rs");
+    }
+  }
+
+  // Header/source pairs and conventional test files.
+  if (c_like) {
+    for (const char *e : {".h", ".hpp", ".cpp", ".cc", ".c"})
+      if (ext != e)
+        add(dir / (stem + e));
+    add(dir / (stem + "_test" + ext));
+    add(fs::path("test") / (stem + "_test.cpp"));
+    add(fs::path("tests") / (stem + "_test.cpp"));
+  } else if (python && !stem.starts_with("test_")) {
+    add(dir / ("test_" + stem + ".py"));
+    add(fs::path("tests") / ("test_" + stem + ".py"));
+  } else if (js) {
+    add(dir / (stem + ".test" + ext));
+    add(dir / (stem + ".spec" + ext));
+  } else if (ext == ".go" && !stem.ends_with("_test")) {
+    add(dir / (stem + "_test.go"));
+  }
+  return out;
+}
+
+} // namespace tools
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace tools {
+
+struct FileCacheStats {
+  std::uint64_t hits = 0;
+  std::uint64_t misses = 0;
+  // Hits on entries the prefetcher loaded before anyone asked for them.
+  std::uint64_t prefetch_hits = 0;
+  std::uint64_t prefetched = 0;
+  std::size_t bytes = 0;
+  std::size_t entries = 0;
+};
+
+// Identity of a file's current contents as far as stat(2) can tell.
+struct FileStamp {
+  std::uint64_t size = 0;
+  std::int64_t mtime_ns = 0;
+  std::uint64_t inode = 0;
+  bool operator==(const FileStamp &) const = default;
+};
+
+// Stamps the regular file at `path`; false if there is none.
+bool stat_file(const std::string &path, FileStamp &stamp);
+
+// In-memory cache of file contents for the file tools, validated against
+// the file's size, mtime and inode on every lookup so edits made behind
+// its back (by bash, an editor) are never served stale. A background
+// thread warms it with files the model is likely to read next; see
+// prefetch_candidates().
+class FileCache {
+public:
+  explicit FileCache(std::size_t capacity_bytes = 64 * 1024 * 1024);
+  ~FileCache();
+  FileCache(const FileCache &) = delete;
+  FileCache &operator=(const FileCache &) = delete;
+
+  // Current contents of `path`, from the cache when still valid; null if
+  // the file cannot be read.
+  std::shared_ptr<const std::string> read(const std::string &path);
+
+  // Drops `path` after the tools rewrote it.
+  void invalidate(const std::string &path);
+
+  // Queues `paths` for loading on the background thread. Missing files
+  // and files already cached are skipped.
+  void prefetch(std::vector<std::string> paths);
+
+  void set_capacity(std::size_t bytes);
+  // Evicts least recently used entries until at most `bytes` remain.
+  void shrink_to(std::size_t bytes);
+
+  FileCacheStats stats() const;
+
+private:
+  struct Entry {
+    std::shared_ptr<const std::string> content;
+    FileStamp stamp;
+    bool prefetched = false;
+    std::list<std::string>::iterator lru;
+  };
+
+  static std::shared_ptr<const std::string> load(const std::string &path,
+                                                 std::uint64_t size);
+  void insert(const std::string &key, std::shared_ptr<const std::string> content,
+              const FileStamp &stamp, bool prefetched);
+  void evict_locked(std::size_t limit);
+  void worker();
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  // Most recently used at the front.
+  std::list<std::string> lru_;
+  std::size_t capacity_;
+  FileCacheStats stats_;
+
+  std::condition_variable queue_cv_;
+  std::deque<std::string> queue_;
+  std::unordered_set<std::string> queued_;
+  bool stopping_ = false;
+  std::thread thread_;
+};
+
+// Process-wide cache used by the file tools.
+FileCache &file_cache();
+
+// Files the model is likely to read after `path`: local includes and
+// imports found in `content` (C/C++, Python, JS/TS, Rust), the matching
+// header or source, and conventional test files. Paths are not checked
+// for existence.
+std::vector<std::string> prefetch_candidates(const std::string &path,
+                                             std::string_view content);
+
+} // namespace tools
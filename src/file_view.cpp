@@ -0,0 +1,172 @@
+#include "file_view.hpp"
+#include "file_cache.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace tools {
+
+namespace {
+
+// Files up to this size are read through the file cache; larger ones are
+// mapped so that paging through a big log never copies all of it.
+constexpr std::uint64_t map_threshold = 1024 * 1024;
+constexpr std::size_t cached_views = 8;
+
+struct Mapping {
+  void *addr = nullptr;
+  std::size_t size = 0;
+  ~Mapping() {
+    if (addr)
+      ::munmap(addr, size);
+  }
+};
+
+// Maps `path` read-only. A file truncated by another process while mapped
+// faults on access past its new end; the stamp check keeps that window to a
+// single call.
+std::shared_ptr<const Mapping> map_file(const std::string &path,
+                                        std::size_t size) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+  void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED)
+    return nullptr;
+  ::madvise(addr, size, MADV_SEQUENTIAL);
+  auto mapping = std::make_shared<Mapping>();
+  mapping->addr = addr;
+  mapping->size = size;
+  return mapping;
+}
+
+struct CachedView {
+  std::string path;
+  FileStamp stamp;
+  std::shared_ptr<const FileView> view;
+};
+
+std::mutex cache_mutex;
+// Most recently used at the front.
+std::list<CachedView> cache;
+
+} // namespace
+
+FileView::FileView(std::shared_ptr<const void> owner, std::string_view text)
+    : owner_(std::move(owner)), text_(text) {
+  const char *p = text_.data();
+  std::size_t n = text_.size();
+  std::uint64_t newlines = 0;
+  // Newline count at which the next mark starts.
+  std::uint64_t next_mark = stride;
+  marks_.reserve(n / (stride * 40) + 1);
+  marks_.push_back(0);
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  // 64 bytes per step: four compares folded into one bit mask, so dense
+  // short lines cost a popcount rather than a call per line.
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; i + 64 <= n; i += 64) {
+    auto block = [&](std::size_t at) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + at));
+      return static_cast<std::uint64_t>(static_cast<std::uint32_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl))));
+    };
+    std::uint64_t mask = block(i) | block(i + 16) << 16 |
+                         block(i + 32) << 32 | block(i + 48) << 48;
+    auto count = static_cast<std::uint64_t>(std::popcount(mask));
+    if (newlines + count < next_mark) {
+      newlines += count;
+      continue;
+    }
+    for (; mask; mask &= mask - 1) {
+      if (++newlines == next_mark) {
+        marks_.push_back(i + std::countr_zero(mask) + 1);
+        next_mark += stride;
+      }
+    }
+  }
+#endif
+  while (i < n) {
+    const void *hit = std::memchr(p + i, '\n', n - i);
+    if (!hit)
+      break;
+    i = static_cast<const char *>(hit) - p + 1;
+    if (++newlines == next_mark) {
+      marks_.push_back(i);
+      next_mark += stride;
+    }
+  }
+  lines_ = newlines + (n > 0 && p[n - 1] != '\n');
+  // A mark exactly at the end starts no line.
+  if (marks_.size() > 1 && marks_.back() == n)
+    marks_.pop_back();
+}
+
+std::size_t FileView::line_start(std::size_t line) const {
+  line = std::min(line, lines_);
+  std::size_t mark = std::min(line / stride, marks_.size() - 1);
+  std::size_t pos = marks_[mark];
+  for (std::size_t skip = line - mark * stride; skip > 0; --skip) {
+    std::size_t end = text_.find('\n', pos);
+    if (end == std::string_view::npos)
+      return text_.size();
+    pos = end + 1;
+  }
+  return pos;
+}
+
+std::shared_ptr<const FileView> open_file_view(const std::string &path) {
+  std::string key = std::filesystem::path(path).lexically_normal().string();
+  FileStamp stamp;
+  if (!stat_file(key, stamp))
+    return nullptr;
+  {
+    std::lock_guard lock(cache_mutex);
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+      if (it->path != key)
+        continue;
+      if (it->stamp == stamp) {
+        cache.splice(cache.begin(), cache, it);
+        return it->view;
+      }
+      cache.erase(it);
+      break;
+    }
+  }
+
+  std::shared_ptr<const FileView> view;
+  if (stamp.size <= map_threshold) {
+    auto content = file_cache().read(key);
+    if (!content)
+      return nullptr;
+    std::string_view text = *content;
+    view = std::make_shared<const FileView>(std::move(content), text);
+  } else {
+    auto mapping = map_file(key, static_cast<std::size_t>(stamp.size));
+    if (!mapping)
+      return nullptr;
+    std::string_view text(static_cast<const char *>(mapping->addr),
+                          mapping->size);
+    view = std::make_shared<const FileView>(std::move(mapping), text);
+  }
+
+  std::lock_guard lock(cache_mutex);
+  cache.push_front({std::move(key), stamp, view});
+  if (cache.size() > cached_views)
+    cache.pop_back();
+  return view;
+}
+
+} // namespace tools
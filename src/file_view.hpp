@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tools {
+
+// Read-only contents of a file together with a sparse index of its line
+// starts: one offset per `stride` lines, found with a vectorized newline
+// scan when the view is built. Seeking to a line costs at most `stride`
+// line scans, so slicing a large file is proportional to the slice, and
+// the index stays small (8 bytes per 64 lines).
+class FileView {
+public:
+  static constexpr std::size_t stride = 64;
+
+  // Indexes `text`, which `owner` keeps alive.
+  FileView(std::shared_ptr<const void> owner, std::string_view text);
+
+  std::string_view text() const { return text_; }
+
+  // Number of lines; a final line without a newline counts.
+  std::size_t lines() const { return lines_; }
+
+  // Byte offset of the start of `line` (0-based, at most lines()).
+  std::size_t line_start(std::size_t line) const;
+
+private:
+  std::shared_ptr<const void> owner_;
+  std::string_view text_;
+  // marks_[i] is the offset of line i * stride.
+  std::vector<std::uint64_t> marks_;
+  std::size_t lines_ = 0;
+};
+
+// Current contents of `path` as an indexed view; null if the file cannot
+// be read. Small files come from the file cache, large ones are mapped.
+// Views are cached by path and revalidated against the file's size, mtime
+// and inode, so paging through a large file indexes it once.
+std::shared_ptr<const FileView> open_file_view(const std::string &path);
+
+} // namespace tools
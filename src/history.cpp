@@ -0,0 +1,144 @@
+#include "history.hpp"
+#include "spill.hpp"
+
+#include <algorithm>
+#include <boost/json.hpp>
+#include <utility>
+
+namespace agent {
+
+namespace {
+
+std::size_t json_bytes(const boost::json::object &object);
+
+std::size_t json_bytes(const boost::json::value &value) {
+  std::size_t bytes = sizeof(boost::json::value);
+  if (const auto *s = value.if_string()) {
+    bytes += s->capacity();
+  } else if (const auto *a = value.if_array()) {
+    for (const auto &element : *a)
+      bytes += json_bytes(element);
+  } else if (const auto *o = value.if_object()) {
+    bytes += json_bytes(*o);
+  }
+  return bytes;
+}
+
+std::size_t json_bytes(const boost::json::object &object) {
+  std::size_t bytes = 0;
+  for (const auto &kv : object)
+    bytes += kv.key().size() + json_bytes(kv.value());
+  return bytes;
+}
+
+} // namespace
+
+std::size_t History::message_bytes(const Message &message) {
+  std::size_t bytes =
+      sizeof(Node) + message.content.capacity() * sizeof(ContentBlock);
+  for (const auto &block : message.content) {
+    if (const auto *text = std::get_if<TextBlock>(&block))
+      bytes += text->text.capacity();
+    else if (const auto *use = std::get_if<ToolUseBlock>(&block))
+      bytes += json_bytes(use->input);
+    else if (const auto *result = std::get_if<ToolResultBlock>(&block))
+      bytes += result->content.capacity();
+  }
+  return bytes;
+}
+
+History::History(History &&other) noexcept
+    : tail_(std::move(other.tail_)), index_(std::move(other.index_)),
+      bytes_(std::exchange(other.bytes_, 0)),
+      spill_checked_(std::exchange(other.spill_checked_, 0)),
+      spill_min_bytes_(std::exchange(other.spill_min_bytes_, 0)) {}
+
+History &History::operator=(const History &other) {
+  if (this != &other) {
+    release();
+    tail_ = other.tail_;
+    index_ = other.index_;
+    bytes_ = other.bytes_;
+    spill_checked_ = other.spill_checked_;
+    spill_min_bytes_ = other.spill_min_bytes_;
+  }
+  return *this;
+}
+
+History &History::operator=(History &&other) noexcept {
+  if (this != &other) {
+    release();
+    tail_ = std::move(other.tail_);
+    index_ = std::move(other.index_);
+    bytes_ = std::exchange(other.bytes_, 0);
+    spill_checked_ = other.spill_checked_;
+    spill_min_bytes_ = other.spill_min_bytes_;
+    other.index_.clear();
+    other.spill_checked_ = 0;
+    other.spill_min_bytes_ = 0;
+  }
+  return *this;
+}
+
+History::~History() { release(); }
+
+void History::push_back(Message message) {
+  tail_ = std::make_shared<Node>(Node{std::move(message), std::move(tail_)});
+  index_.push_back(&tail_->message);
+  bytes_ += message_bytes(tail_->message);
+}
+
+void History::clear() {
+  release();
+  index_.clear();
+  bytes_ = 0;
+  spill_checked_ = 0;
+  spill_min_bytes_ = 0;
+}
+
+std::size_t History::spill_cold(SpillFile &spill, std::size_t keep_recent,
+                                std::size_t min_bytes) {
+  if (min_bytes < spill_min_bytes_)
+    spill_checked_ = 0;
+  spill_min_bytes_ = min_bytes;
+  std::size_t freed = 0;
+  std::size_t end =
+      index_.size() > keep_recent ? index_.size() - keep_recent : 0;
+  for (; spill_checked_ < end; ++spill_checked_) {
+    // Only the results' mutable storage changes, so other branches sharing
+    // the node see the same text.
+    for (const auto &block : index_[spill_checked_]->content) {
+      const auto *result = std::get_if<ToolResultBlock>(&block);
+      if (!result || result->spill_owner || result->content.size() < min_bytes)
+        continue;
+      auto [owner, stored] = spill.store(result->content);
+      if (!owner)
+        continue;
+      freed += result->content.size();
+      bytes_ -= std::min(bytes_, result->content.capacity());
+      result->spilled = stored;
+      result->spill_owner = std::move(owner);
+      std::string().swap(result->content);
+    }
+  }
+  return freed;
+}
+
+std::size_t
+History::heap_bytes(std::unordered_set<const Message *> &seen) const {
+  std::size_t bytes = index_.capacity() * sizeof(const Message *);
+  for (const Message *message : index_) {
+    if (seen.insert(message).second)
+      bytes += message_bytes(*message);
+  }
+  return bytes;
+}
+
+void History::release() {
+  std::shared_ptr<Node> node = std::move(tail_);
+  // Only unlink nodes no other branch still references.
+  while (node && node.use_count() == 1)
+    node = std::move(node->prev);
+}
+
+} // namespace agent
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "message.hpp"
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <unordered_set>
+#include <vector>
+
+namespace agent {
+
+class SpillFile;
+
+// Persistent, append-only message list. Messages live in immutable nodes
+// linked towards the root, so copying a History (a /fork) shares every
+// existing message with the original and costs one pointer per message for
+// the copy's index; appending to either copy never affects the other.
+class History {
+public:
+  History() = default;
+  History(const History &) = default;
+  History(History &&other) noexcept;
+  History &operator=(const History &other);
+  History &operator=(History &&other) noexcept;
+  ~History();
+
+  void push_back(Message message);
+  void clear();
+
+  std::size_t size() const { return index_.size(); }
+  bool empty() const { return index_.empty(); }
+  const Message &operator[](std::size_t i) const { return *index_[i]; }
+
+  // Oldest-first view of the messages.
+  std::span<const Message *const> messages() const { return index_; }
+
+  void reserve(std::size_t n) { index_.reserve(n); }
+
+  // Moves tool results of at least `min_bytes` that are older than the last
+  // `keep_recent` messages into `spill`, returning the heap bytes freed.
+  // Only the representation changes, so nodes shared with other branches
+  // are updated in place. A smaller `min_bytes` than the last call's
+  // revisits older messages.
+  std::size_t spill_cold(SpillFile &spill, std::size_t keep_recent,
+                         std::size_t min_bytes);
+
+  // Approximate heap bytes held by messages not yet in `seen`, which are
+  // then added to it; branches sharing nodes are counted once this way.
+  std::size_t heap_bytes(std::unordered_set<const Message *> &seen) const;
+
+  // Running total of heap_bytes() for this list alone, kept as messages are
+  // added and spilled. Messages shared with other branches count in each,
+  // and a spill through another branch is not seen here, so it can only
+  // overestimate.
+  std::size_t bytes() const { return bytes_; }
+
+private:
+  struct Node {
+    Message message;
+    std::shared_ptr<Node> prev;
+  };
+
+  static std::size_t message_bytes(const Message &message);
+
+  // Drops this list's reference to its nodes iteratively; a recursive
+  // shared_ptr chain would overflow the stack on very long sessions.
+  void release();
+
+  std::shared_ptr<Node> tail_;
+  std::vector<const Message *> index_;
+  std::size_t bytes_ = 0;
+  // Messages before this index have already been considered for spilling
+  // with a threshold of spill_min_bytes_.
+  std::size_t spill_checked_ = 0;
+  std::size_t spill_min_bytes_ = 0;
+};
+
+} // namespace agent
@@ -1,4 +1,5 @@
 #include "llm_client.hpp"
+#include "trace.hpp"
 
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
@@ -13,6 +14,7 @@
 #include <boost/beast/http.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/beast/version.hpp>
+#include <fstream>
 #include <iostream>
 
 namespace beast = boost::beast;   // from <boost/beast.hpp>
@@ -23,16 +25,40 @@ using tcp = boost::asio::ip::tcp; // from <boost/asio/ip/tcp.hpp>
 
 namespace llm {
 
+namespace {
+
+std::uint64_t usage_field(const boost::json::object &usage,
+                          boost::json::string_view key) {
+  auto it = usage.find(key);
+  if (it == usage.end())
+    return 0;
+  if (auto *u = it->value().if_uint64())
+    return *u;
+  if (auto *i = it->value().if_int64())
+    return *i > 0 ? static_cast<std::uint64_t>(*i) : 0;
+  return 0;
+}
+
+// Accumulates an Anthropic or OpenAI "usage" object into `response`.
+void add_usage(const boost::json::value *usage, LLMResponse &response) {
+  if (!usage || !usage->is_object())
+    return;
+  const auto &u = usage->get_object();
+  response.input_tokens += usage_field(u, "input_tokens") +
+                           usage_field(u, "cache_creation_input_tokens") +
+                           usage_field(u, "cache_read_input_tokens") +
+                           usage_field(u, "prompt_tokens");
+  response.output_tokens +=
+      usage_field(u, "output_tokens") + usage_field(u, "completion_tokens");
+}
+
+} // namespace
+
 boost::asio::awaitable<std::expected<LLMResponse, std::string>>
-send_request(const LLMConfig &config, boost::json::object payload,
+send_request(const LLMConfig &config, std::string body,
              ChunkCallback on_chunk) {
   auto executor = co_await net::this_coro::executor;
-
-  if (on_chunk) {
-    if (config.is_anthropic_format || config.is_openai_format) {
-      payload["stream"] = true;
-    }
-  }
+  trace::Span request_span("send_request", trace::Track::network);
 
   // Parse URL (e.g. "https://api.anthropic.com/v1/messages")
   std::string url = config.api_url;
@@ -57,9 +83,11 @@ send_request(const LLMConfig &config, boost::json::object payload,
 
   try {
     // Look up the domain name
+    trace::Span resolve_span("resolve", trace::Track::network);
     tcp::resolver resolver(executor);
     auto const results =
         co_await resolver.async_resolve(host, port, net::use_awaitable);
+    resolve_span.end();
 
     // Make the connection on the IP address we get from a lookup
     beast::ssl_stream<beast::tcp_stream> stream(executor, ctx);
@@ -71,12 +99,16 @@ send_request(const LLMConfig &config, boost::json::object payload,
       throw boost::system::system_error{ec};
     }
 
+    trace::Span connect_span("connect", trace::Track::network);
     co_await beast::get_lowest_layer(stream).async_connect(results,
                                                            net::use_awaitable);
+    connect_span.end();
 
     // Perform the SSL handshake
+    trace::Span handshake_span("tls_handshake", trace::Track::network);
     co_await stream.async_handshake(ssl::stream_base::client,
                                     net::use_awaitable);
+    handshake_span.end();
 
     // Set up an HTTP POST request message
     http::request<http::string_body> req{http::verb::post, target, 11};
@@ -95,17 +127,21 @@ send_request(const LLMConfig &config, boost::json::object payload,
       req.set(http::field::authorization, "Bearer " + config.api_key);
     }
 
-    req.body() = boost::json::serialize(payload);
+    req.body() = std::move(body);
     req.prepare_payload();
 
     // Send the HTTP request
+    trace::Span write_span("write_request", trace::Track::network);
     co_await http::async_write(stream, req, net::use_awaitable);
+    write_span.end();
 
     beast::flat_buffer buffer;
 
     if (!on_chunk) {
       http::response<http::string_body> res;
+      trace::Span read_span("read_response", trace::Track::network);
       co_await http::async_read(stream, buffer, res, net::use_awaitable);
+      read_span.end();
 
       // Gracefully close the stream
       boost::system::error_code ec;
@@ -115,28 +151,36 @@ send_request(const LLMConfig &config, boost::json::object payload,
         ec = {};
       }
 
+      trace::Span parse_span("parse_response", trace::Track::network);
       boost::system::error_code parse_ec;
       boost::json::value parsed = boost::json::parse(res.body(), parse_ec);
+      parse_span.end();
 
       if (parse_ec) {
         co_return std::unexpected("JSON Parse Error: " + parse_ec.message() +
                                   "\nResponse body:\n" + res.body());
       }
 
+      LLMResponse response;
       if (parsed.is_array() && !parsed.as_array().empty() &&
           parsed.as_array()[0].is_object()) {
-        co_return LLMResponse{parsed.as_array()[0].as_object()};
+        response.raw_json = std::move(parsed.as_array()[0].as_object());
       } else if (!parsed.is_object()) {
         co_return std::unexpected("API Response is not a JSON object nor an "
                                   "object array.\nResponse body:\n" +
                                   res.body());
+      } else {
+        response.raw_json = std::move(parsed.as_object());
       }
-      co_return LLMResponse{parsed.as_object()};
+      add_usage(response.raw_json.if_contains("usage"), response);
+      co_return response;
     } else {
       http::response_parser<http::buffer_body> parser;
       parser.body_limit(1024ULL * 1024ULL * 100ULL);
+      trace::Span header_span("read_headers", trace::Track::network);
       co_await http::async_read_header(stream, buffer, parser,
                                        net::use_awaitable);
+      header_span.end();
 
       if (parser.get().result() != http::status::ok) {
         std::string err_body;
@@ -171,7 +215,15 @@ send_request(const LLMConfig &config, boost::json::object payload,
       boost::json::object current_anthropic_tool;
       boost::json::object current_openai_tool;
       std::string current_tool_args;
+      LLMResponse response;
+
+      // Each SSE event is parsed into a stack arena that is recycled for the
+      // next event; anything kept is copied out into the default resource.
+      unsigned char event_buf[16 * 1024];
+      boost::json::monotonic_resource event_arena(event_buf,
+                                                  sizeof(event_buf));
 
+      trace::Span stream_span("stream_body", trace::Track::network);
       while (!parser.is_done()) {
         boost::system::error_code ec;
         co_await http::async_read_some(
@@ -197,8 +249,10 @@ send_request(const LLMConfig &config, boost::json::object payload,
             if (data_str == "[DONE]")
               continue;
 
+            event_arena.release();
             boost::system::error_code parse_ec;
-            boost::json::value parsed = boost::json::parse(data_str, parse_ec);
+            boost::json::value parsed =
+                boost::json::parse(data_str, parse_ec, &event_arena);
             if (parse_ec || !parsed.is_object())
               continue;
 
@@ -207,7 +261,14 @@ send_request(const LLMConfig &config, boost::json::object payload,
             if (config.is_anthropic_format) {
               if (obj.contains("type")) {
                 std::string type = obj.at("type").as_string().c_str();
-                if (type == "content_block_start") {
+                if (type == "message_start") {
+                  if (auto *message = obj.if_contains("message");
+                      message && message->is_object())
+                    add_usage(message->get_object().if_contains("usage"),
+                              response);
+                } else if (type == "message_delta") {
+                  add_usage(obj.if_contains("usage"), response);
+                } else if (type == "content_block_start") {
                   auto &block = obj.at("content_block").as_object();
                   if (block.at("type").as_string() == "tool_use") {
                     current_anthropic_tool = {{"type", "tool_use"},
@@ -232,12 +293,15 @@ send_request(const LLMConfig &config, boost::json::object payload,
                     if (!current_tool_args.empty())
                       current_anthropic_tool["input"] =
                           boost::json::parse(current_tool_args);
-                    anthropic_content.push_back(current_anthropic_tool);
+                    anthropic_content.push_back(
+                        std::move(current_anthropic_tool));
                     current_anthropic_tool = {};
                   }
                 }
               }
             } else if (config.is_openai_format) {
+              // Sent on the final chunk by providers that report usage.
+              add_usage(obj.if_contains("usage"), response);
               if (obj.contains("choices") && obj.at("choices").is_array() &&
                   !obj.at("choices").as_array().empty()) {
                 auto &choice = obj.at("choices").as_array()[0].as_object();
@@ -258,7 +322,8 @@ send_request(const LLMConfig &config, boost::json::object payload,
                         if (!current_openai_tool.empty()) {
                           current_openai_tool.at("function")
                               .as_object()["arguments"] = current_tool_args;
-                          openai_tool_calls.push_back(current_openai_tool);
+                          openai_tool_calls.push_back(
+                              std::move(current_openai_tool));
                         }
                         current_openai_tool = {
                             {"id", tc.at("id")},
@@ -287,33 +352,108 @@ send_request(const LLMConfig &config, boost::json::object payload,
       if (config.is_openai_format && !current_openai_tool.empty()) {
         current_openai_tool.at("function").as_object()["arguments"] =
             current_tool_args;
-        openai_tool_calls.push_back(current_openai_tool);
+        openai_tool_calls.push_back(std::move(current_openai_tool));
       }
 
+      stream_span.end();
+
       boost::json::object final_resp;
       if (config.is_anthropic_format) {
         if (!final_text.empty())
           anthropic_content.insert(anthropic_content.begin(),
                                    {{"type", "text"}, {"text", final_text}});
-        final_resp["content"] = anthropic_content;
+        final_resp["content"] = std::move(anthropic_content);
       } else {
         boost::json::object msg;
         msg["role"] = "assistant";
         if (!final_text.empty())
           msg["content"] = final_text;
         if (!openai_tool_calls.empty())
-          msg["tool_calls"] = openai_tool_calls;
-        final_resp["choices"] = boost::json::array{{{"message", msg}}};
+          msg["tool_calls"] = std::move(openai_tool_calls);
+        boost::json::object choice;
+        choice["message"] = std::move(msg);
+        boost::json::array choices;
+        choices.push_back(std::move(choice));
+        final_resp["choices"] = std::move(choices);
       }
 
+      trace::Span shutdown_span("shutdown", trace::Track::network);
       boost::system::error_code ec;
       co_await stream.async_shutdown(
           net::redirect_error(net::use_awaitable, ec));
-      co_return LLMResponse{final_resp};
+      shutdown_span.end();
+      response.raw_json = std::move(final_resp);
+      co_return response;
     }
   } catch (std::exception const &e) {
     co_return std::unexpected(std::string("HTTP Error: ") + e.what());
   }
 }
 
+std::expected<Replay, std::string> Replay::load(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in)
+    return std::unexpected("cannot open " + path);
+  Replay replay;
+  std::string line;
+  while (std::getline(in, line))
+    if (!line.empty())
+      replay.lines_.push_back(std::move(line));
+  return replay;
+}
+
+std::expected<LLMResponse, std::string>
+Replay::next(const ChunkCallback &on_chunk) {
+  if (next_ == lines_.size())
+    return std::unexpected("replay exhausted after " +
+                           std::to_string(lines_.size()) + " responses");
+  boost::system::error_code ec;
+  boost::json::value entry = boost::json::parse(lines_[next_++], ec);
+  if (ec || !entry.is_object())
+    return std::unexpected("bad replay entry " + std::to_string(next_));
+  auto &obj = entry.get_object();
+  LLMResponse response;
+  if (auto *raw = obj.if_contains("response"); raw && raw->is_object())
+    response.raw_json = std::move(raw->get_object());
+  add_usage(obj.if_contains("usage"), response);
+
+  if (on_chunk) {
+    // Stream the text the way a live response would have been rendered.
+    std::string text;
+    if (auto *content = response.raw_json.if_contains("content");
+        content && content->is_array()) {
+      for (const auto &block : content->get_array())
+        if (block.is_object())
+          if (auto *t = block.get_object().if_contains("text");
+              t && t->is_string())
+            text.append(t->get_string().data(), t->get_string().size());
+    } else if (auto *choices = response.raw_json.if_contains("choices");
+               choices && choices->is_array() &&
+               !choices->get_array().empty() &&
+               choices->get_array()[0].is_object()) {
+      if (auto *message = choices->get_array()[0].get_object().if_contains(
+              "message");
+          message && message->is_object())
+        if (auto *t = message->get_object().if_contains("content");
+            t && t->is_string())
+          text.assign(t->get_string().data(), t->get_string().size());
+    }
+    if (!text.empty())
+      on_chunk(text);
+  }
+  return response;
+}
+
+bool record_response(const std::string &path, const LLMResponse &response) {
+  std::ofstream out(path, std::ios::binary | std::ios::app);
+  if (!out)
+    return false;
+  boost::json::object entry;
+  entry["response"] = response.raw_json;
+  entry["usage"] = {{"input_tokens", response.input_tokens},
+                    {"output_tokens", response.output_tokens}};
+  out << boost::json::serialize(entry) << '\n';
+  return static_cast<bool>(out);
+}
+
 } // namespace llm
@@ -2,6 +2,7 @@
 
 #include <boost/asio/awaitable.hpp>
 #include <boost/json.hpp>
+#include <cstdint>
 #include <expected>
 #include <string>
 #include <vector>
@@ -16,6 +17,10 @@ struct LLMConfig {
 
 struct LLMResponse {
   boost::json::object raw_json;
+  // Token usage reported by the provider, if any. Input includes prompt
+  // cache reads and writes.
+  std::uint64_t input_tokens = 0;
+  std::uint64_t output_tokens = 0;
 };
 
 #include <functional>
@@ -27,8 +32,30 @@ using ChunkCallback = std::function<void(const std::string &)>;
 // Sends an asynchronous POST request using Boost.Asio coroutines.
 // `host` and `target` are extracted from the config.api_url (e.g. host:
 // api.anthropic.com, target: /v1/messages)
+// `body` is the serialized JSON payload; it must ask for "stream": true
+// exactly when `on_chunk` is set.
 boost::asio::awaitable<std::expected<LLMResponse, std::string>>
-send_request(const LLMConfig &config, boost::json::object payload,
+send_request(const LLMConfig &config, std::string body,
              ChunkCallback on_chunk = nullptr);
 
+// Offline stand-in for send_request: hands out responses saved with
+// record_response(), one JSON line per request, in order. Response text is
+// passed to `on_chunk` as a single chunk.
+class Replay {
+public:
+  static std::expected<Replay, std::string> load(const std::string &path);
+
+  std::expected<LLMResponse, std::string>
+  next(const ChunkCallback &on_chunk = nullptr);
+
+  std::size_t remaining() const { return lines_.size() - next_; }
+
+private:
+  std::vector<std::string> lines_;
+  std::size_t next_ = 0;
+};
+
+// Appends `response` to the replay file at `path`.
+bool record_response(const std::string &path, const LLMResponse &response);
+
 } // namespace llm
@@ -1,10 +1,15 @@
 #include "agent.hpp"
+#include "eval.hpp"
+#include "output.hpp"
+#include "trace.hpp"
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/detached.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <cstdlib>
+#include <filesystem>
 #include <iostream>
+#include <unistd.h>
 
 #include <fstream>
 #include <string>
@@ -38,10 +43,47 @@ int main(int argc, char **argv) {
   load_env_file(".env");
 
   std::string cli_model;
+  std::string cli_fps;
+  std::string cli_fast_model;
+  std::string cli_trace;
+  std::string cli_replay;
+  std::string cli_record;
+  std::string cli_map_tokens;
+  std::string cli_mem_limit;
+  std::string eval_suite;
+  std::string worker_socket;
+  eval::EvalOptions eval_options;
   for (int i = 1; i < argc; ++i) {
     std::string arg = argv[i];
-    if (arg == "--model" && i + 1 < argc) {
+    if (arg == "eval" && i == 1 && i + 1 < argc) {
+      eval_suite = argv[++i];
+    } else if (arg == "--jobs" && i + 1 < argc) {
+      long jobs = std::strtol(argv[++i], nullptr, 10);
+      if (jobs > 0)
+        eval_options.jobs = static_cast<unsigned>(jobs);
+    } else if (arg == "--retries" && i + 1 < argc) {
+      eval_options.retries =
+          static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--worker" && i + 1 < argc) {
+      worker_socket = argv[++i];
+    } else if (arg == "--keep") {
+      eval_options.keep_worktrees = true;
+    } else if (arg == "--replay" && i + 1 < argc) {
+      cli_replay = argv[++i];
+    } else if (arg == "--record" && i + 1 < argc) {
+      cli_record = argv[++i];
+    } else if (arg == "--model" && i + 1 < argc) {
       cli_model = argv[++i];
+    } else if (arg == "--fps" && i + 1 < argc) {
+      cli_fps = argv[++i];
+    } else if (arg == "--fast-model" && i + 1 < argc) {
+      cli_fast_model = argv[++i];
+    } else if (arg == "--mem-limit" && i + 1 < argc) {
+      cli_mem_limit = argv[++i];
+    } else if (arg == "--map-tokens" && i + 1 < argc) {
+      cli_map_tokens = argv[++i];
+    } else if (arg == "--trace" && i + 1 < argc) {
+      cli_trace = argv[++i];
     }
   }
 
@@ -60,7 +102,9 @@ int main(int argc, char **argv) {
     initial_model = "gemini-2.5-flash";
   }
 
-  if (!gemini && !anthropic && !openrouter) {
+  // Offline runs and eval suites (whose tasks may replay) need no key.
+  if (!gemini && !anthropic && !openrouter && cli_replay.empty() &&
+      eval_suite.empty() && worker_socket.empty()) {
     std::cerr << "Error: Must set GEMINI_API_KEY, OPENROUTER_API_KEY, or "
                  "ANTHROPIC_API_KEY in environment.\n";
     return EXIT_FAILURE;
@@ -74,6 +118,76 @@ int main(int argc, char **argv) {
   if (openrouter)
     config.openrouter_key = openrouter;
   config.initial_model = initial_model;
+  if (!cli_fast_model.empty())
+    config.fast_model = cli_fast_model;
+  else if (std::getenv("FAST_MODEL"))
+    config.fast_model = std::getenv("FAST_MODEL");
+  if (cli_fps.empty() && std::getenv("NANOCODE_FPS"))
+    cli_fps = std::getenv("NANOCODE_FPS");
+  if (!cli_fps.empty()) {
+    long fps = std::strtol(cli_fps.c_str(), nullptr, 10);
+    if (fps > 0)
+      config.output_fps = static_cast<unsigned>(fps);
+  }
+
+  if (cli_mem_limit.empty() && std::getenv("NANOCODE_MEM_LIMIT"))
+    cli_mem_limit = std::getenv("NANOCODE_MEM_LIMIT");
+  if (!cli_mem_limit.empty())
+    config.memory_limit = static_cast<std::size_t>(std::strtoul(
+                              cli_mem_limit.c_str(), nullptr, 10))
+                          << 20;
+  if (!cli_map_tokens.empty())
+    config.repo_map_tokens = std::strtoul(cli_map_tokens.c_str(), nullptr, 10);
+
+  if (const char *home = std::getenv("HOME"))
+    config.session_index_path = std::string(home) + "/.nanocode/sessions.idx";
+  config.record_path = cli_record;
+  if (!cli_replay.empty()) {
+    auto replay = llm::Replay::load(cli_replay);
+    if (!replay) {
+      std::cerr << "Error: " << replay.error() << "\n";
+      return EXIT_FAILURE;
+    }
+    config.replay = std::make_shared<llm::Replay>(std::move(*replay));
+    config.replay_path = cli_replay;
+  }
+
+  // Worker processes are started from here, before any threads exist.
+  if (!worker_socket.empty()) {
+    // Each worker keeps its own timeline next to the requested one.
+    if (!cli_trace.empty())
+      trace::start(cli_trace + "." + std::to_string(::getpid()));
+    int status = eval::run_worker(worker_socket, config);
+    trace::finish();
+    return status;
+  }
+  if (!eval_suite.empty()) {
+    eval_options.self_path = std::filesystem::exists("/proc/self/exe")
+                                 ? "/proc/self/exe"
+                                 : argv[0];
+    // Workers parse the same settings again. Paths are made absolute since
+    // tasks run from inside their worktrees.
+    auto forward = [&](const char *flag, const std::string &value,
+                       bool is_path = false) {
+      if (value.empty())
+        return;
+      eval_options.worker_args.push_back(flag);
+      eval_options.worker_args.push_back(
+          is_path ? std::filesystem::absolute(value).string() : value);
+    };
+    forward("--model", cli_model);
+    forward("--fast-model", cli_fast_model);
+    forward("--fps", cli_fps);
+    forward("--mem-limit", cli_mem_limit);
+    forward("--map-tokens", cli_map_tokens);
+    forward("--replay", cli_replay, true);
+    forward("--record", cli_record, true);
+    forward("--trace", cli_trace, true);
+    return eval::run_suite(eval_suite, config, eval_options);
+  }
+
+  if (!cli_trace.empty())
+    trace::start(cli_trace);
 
   try {
     boost::asio::io_context ioc;
@@ -98,6 +212,8 @@ int main(int argc, char **argv) {
 
     // Run the I/O context to execute the coroutines
     ioc.run();
+    term::out().detach();
+    trace::finish();
 
   } catch (const std::exception &e) {
     std::cerr << "\nException: " << e.what() << "\n";
@@ -0,0 +1,207 @@
+#include "markdown.hpp"
+
+namespace markdown {
+
+namespace {
+constexpr std::string_view RESET = "\033[0m";
+constexpr std::string_view BOLD = "\033[1m";
+constexpr std::string_view DIM = "\033[2m";
+constexpr std::string_view BLUE = "\033[34m";
+constexpr std::string_view GREEN = "\033[32m";
+constexpr std::string_view YELLOW = "\033[33m";
+} // namespace
+
+void StreamRenderer::feed(std::string_view chunk, std::string &out) {
+  for (char c : chunk)
+    put(c, out);
+}
+
+void StreamRenderer::finish(std::string &out) {
+  bool styled = bold_ || inline_code_ || header_ || in_fence_;
+  for (; pending_ticks_ > 0; --pending_ticks_)
+    out += '`';
+  for (; pending_hashes_ > 0; --pending_hashes_)
+    out += '#';
+  if (pending_star_)
+    out += '*';
+  if (styled)
+    out += RESET;
+  *this = StreamRenderer(highlight_code_);
+}
+
+void StreamRenderer::apply_style(std::string &out) const {
+  // Styles are re-emitted from scratch on every transition so nested
+  // combinations (bold inside a header, a string inside a code block) never
+  // need a style stack.
+  out += RESET;
+  if (in_fence_) {
+    if (code_comment_)
+      out += DIM;
+    else if (code_string_)
+      out += GREEN;
+    else
+      out += YELLOW;
+    return;
+  }
+  if (header_) {
+    out += BOLD;
+    out += BLUE;
+  }
+  if (bold_)
+    out += BOLD;
+  if (inline_code_)
+    out += YELLOW;
+}
+
+void StreamRenderer::put(char c, std::string &out) {
+  if (skip_to_eol_) {
+    if (c == '\n') {
+      skip_to_eol_ = false;
+      at_line_start_ = true;
+    }
+    return;
+  }
+
+  if (at_line_start_) {
+    if (c == '`' && pending_hashes_ == 0 && pending_ticks_ < 3) {
+      ++pending_ticks_;
+      return;
+    }
+    if (c == '#' && !in_fence_ && pending_ticks_ == 0 && pending_hashes_ < 6) {
+      ++pending_hashes_;
+      return;
+    }
+    end_line_start(c, out);
+    return;
+  }
+
+  if (in_fence_)
+    put_code(c, out);
+  else
+    put_inline(c, out);
+}
+
+void StreamRenderer::end_line_start(char c, std::string &out) {
+  at_line_start_ = false;
+
+  if (pending_ticks_ == 3) {
+    // Fence line: toggle the block and swallow the info string.
+    pending_ticks_ = 0;
+    in_fence_ = !in_fence_;
+    bold_ = inline_code_ = header_ = pending_star_ = false;
+    code_string_ = code_comment_ = false;
+    prev_code_char_ = 0;
+    apply_style(out);
+    if (c == '\n')
+      at_line_start_ = true;
+    else
+      skip_to_eol_ = true;
+    return;
+  }
+
+  if (pending_hashes_ > 0) {
+    int hashes = pending_hashes_;
+    pending_hashes_ = 0;
+    if (c == ' ') {
+      header_ = true;
+      apply_style(out);
+      return;
+    }
+    out.append(hashes, '#');
+  }
+
+  // One or two backticks are not a fence; replay them as ordinary input.
+  for (; pending_ticks_ > 0; --pending_ticks_) {
+    if (in_fence_)
+      put_code('`', out);
+    else
+      put_inline('`', out);
+  }
+
+  if (in_fence_)
+    put_code(c, out);
+  else
+    put_inline(c, out);
+}
+
+void StreamRenderer::put_inline(char c, std::string &out) {
+  if (c == '*' && !inline_code_) {
+    if (pending_star_) {
+      pending_star_ = false;
+      bold_ = !bold_;
+      apply_style(out);
+    } else {
+      pending_star_ = true;
+    }
+    return;
+  }
+  if (pending_star_) {
+    pending_star_ = false;
+    out += '*';
+  }
+
+  if (c == '`') {
+    inline_code_ = !inline_code_;
+    apply_style(out);
+    return;
+  }
+
+  if (c == '\n') {
+    if (header_ || inline_code_) {
+      header_ = inline_code_ = false;
+      apply_style(out);
+    }
+    out += '\n';
+    at_line_start_ = true;
+    return;
+  }
+
+  out += c;
+}
+
+void StreamRenderer::put_code(char c, std::string &out) {
+  if (c == '\n') {
+    if (code_string_ || code_comment_) {
+      code_string_ = code_comment_ = false;
+      apply_style(out);
+    }
+    out += '\n';
+    prev_code_char_ = 0;
+    at_line_start_ = true;
+    return;
+  }
+
+  if (!highlight_code_ || code_comment_) {
+    out += c;
+    return;
+  }
+
+  if (code_string_) {
+    out += c;
+    if (c == code_quote_ && prev_code_char_ != '\\') {
+      code_string_ = false;
+      apply_style(out);
+    }
+    // An escaped backslash must not escape the following quote.
+    prev_code_char_ = (prev_code_char_ == '\\' && c == '\\') ? 0 : c;
+    return;
+  }
+
+  if (c == '"' || c == '\'') {
+    code_string_ = true;
+    code_quote_ = c;
+    apply_style(out);
+    out += c;
+    prev_code_char_ = c;
+    return;
+  }
+
+  if (c == '/' && prev_code_char_ == '/') {
+    code_comment_ = true;
+    apply_style(out);
+  }
+  out += c;
+  prev_code_char_ = c;
+}
+
+} // namespace markdown
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace markdown {
+
+// Incremental markdown-to-ANSI renderer for streamed model output.
+//
+// Deltas are fed as they arrive from the SSE stream; each byte is examined
+// once and any byte that cannot be classified yet (a lone '*' or a run of
+// '`'/'#' at the start of a line) is held back until the next byte arrives,
+// so markers split across chunk boundaries render correctly. Output that has
+// been emitted is never revisited.
+//
+// Supported: **bold**, `inline code`, ``` fenced code blocks ```, and
+// "# " headers.
+class StreamRenderer {
+public:
+  explicit StreamRenderer(bool highlight_code = true)
+      : highlight_code_(highlight_code) {}
+
+  // Renders `chunk` and appends the ANSI-formatted result to `out`.
+  void feed(std::string_view chunk, std::string &out);
+
+  // Flushes held-back bytes, closes any open styles and resets the renderer
+  // for the next message.
+  void finish(std::string &out);
+
+private:
+  void put(char c, std::string &out);
+  void put_inline(char c, std::string &out);
+  void put_code(char c, std::string &out);
+  void end_line_start(char c, std::string &out);
+  void apply_style(std::string &out) const;
+
+  bool highlight_code_;
+
+  // Line-start classification: a run of backticks or hashes is buffered
+  // until the first other byte decides whether it is a fence or a header.
+  bool at_line_start_ = true;
+  int pending_ticks_ = 0;
+  int pending_hashes_ = 0;
+
+  // Inline state
+  bool pending_star_ = false;
+  bool bold_ = false;
+  bool inline_code_ = false;
+  bool header_ = false;
+
+  // Fenced code block state; the info string after the opening fence is
+  // swallowed up to the end of that line.
+  bool in_fence_ = false;
+  bool skip_to_eol_ = false;
+  bool code_string_ = false;
+  char code_quote_ = 0;
+  bool code_comment_ = false;
+  char prev_code_char_ = 0;
+};
+
+} // namespace markdown
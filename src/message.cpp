@@ -0,0 +1,338 @@
+#include "message.hpp"
+
+#include <type_traits>
+
+namespace agent {
+
+std::string_view Interner::intern(std::string_view s) {
+  if (auto it = strings_.find(s); it != strings_.end())
+    return *it;
+  return *strings_.emplace(s).first;
+}
+
+void append_json_string(std::string &out, std::string_view s) {
+  static constexpr char hex[] = "0123456789abcdef";
+  out += '"';
+  std::size_t run = 0;
+  for (std::size_t i = 0; i < s.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(s[i]);
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+    out.append(s.data() + run, i - run);
+    run = i + 1;
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\r':
+      out += "\\r";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    case '\b':
+      out += "\\b";
+      break;
+    case '\f':
+      out += "\\f";
+      break;
+    default:
+      out += "\\u00";
+      out += hex[c >> 4];
+      out += hex[c & 0xf];
+    }
+  }
+  out.append(s.data() + run, s.size() - run);
+  out += '"';
+}
+
+namespace {
+
+std::string_view role_name(Role role) {
+  return role == Role::user ? "user" : "assistant";
+}
+
+std::string_view view(const boost::json::string &s) {
+  return {s.data(), s.size()};
+}
+
+boost::json::string_view json_view(std::string_view s) {
+  return {s.data(), s.size()};
+}
+
+// A user turn typed at the prompt is a single text block; it is sent as a
+// plain string like the original history format.
+const TextBlock *single_text(const Message &message) {
+  if (message.content.size() != 1)
+    return nullptr;
+  return std::get_if<TextBlock>(&message.content.front());
+}
+
+void write_anthropic_block(std::string &out, const ContentBlock &block,
+                           bool cache_breakpoint) {
+  if (auto *text = std::get_if<TextBlock>(&block)) {
+    out += R"({"type":"text","text":)";
+    append_json_string(out, text->text);
+  } else if (auto *use = std::get_if<ToolUseBlock>(&block)) {
+    out += R"({"type":"tool_use","id":)";
+    append_json_string(out, use->id);
+    out += R"(,"name":)";
+    append_json_string(out, use->name);
+    out += R"(,"input":)";
+    out += boost::json::serialize(use->input);
+  } else if (auto *result = std::get_if<ToolResultBlock>(&block)) {
+    out += R"({"type":"tool_result","tool_use_id":)";
+    append_json_string(out, result->tool_use_id);
+    out += R"(,"content":)";
+    append_json_string(out, result->text());
+  }
+  if (cache_breakpoint)
+    out += R"(,"cache_control":{"type":"ephemeral"})";
+  out += '}';
+}
+
+} // namespace
+
+void write_anthropic_messages(std::string &out,
+                              std::span<const Message *const> messages,
+                              std::span<const std::size_t> cache_breakpoints) {
+  out += '[';
+  for (std::size_t idx = 0; idx < messages.size(); ++idx) {
+    const Message &m = *messages[idx];
+    bool breakpoint = false;
+    for (std::size_t b : cache_breakpoints)
+      breakpoint |= b == idx;
+
+    if (idx)
+      out += ',';
+    out += R"({"role":)";
+    append_json_string(out, role_name(m.role));
+    out += R"(,"content":)";
+    if (const TextBlock *text = single_text(m);
+        text && m.role == Role::user && !breakpoint) {
+      append_json_string(out, text->text);
+    } else {
+      out += '[';
+      for (std::size_t i = 0; i < m.content.size(); ++i) {
+        if (i)
+          out += ',';
+        write_anthropic_block(out, m.content[i],
+                              breakpoint && i + 1 == m.content.size());
+      }
+      out += ']';
+    }
+    out += '}';
+  }
+  out += ']';
+}
+
+void write_openai_messages(std::string &out, std::string_view system_prompt,
+                           std::span<const Message *const> messages) {
+  out += R"([{"role":"system","content":)";
+  append_json_string(out, system_prompt);
+  out += '}';
+
+  std::string text;
+  for (const Message *mp : messages) {
+    const Message &m = *mp;
+    if (m.role == Role::user) {
+      // Tool results become one "tool" message each; any text is sent as a
+      // regular user message.
+      text.clear();
+      for (const auto &block : m.content) {
+        if (auto *t = std::get_if<TextBlock>(&block)) {
+          text += t->text;
+        } else if (auto *result = std::get_if<ToolResultBlock>(&block)) {
+          out += R"(,{"role":"tool","tool_call_id":)";
+          append_json_string(out, result->tool_use_id);
+          out += R"(,"content":)";
+          append_json_string(out, result->text());
+          out += '}';
+        }
+      }
+      if (!text.empty()) {
+        out += R"(,{"role":"user","content":)";
+        append_json_string(out, text);
+        out += '}';
+      }
+      continue;
+    }
+
+    text.clear();
+    bool has_calls = false;
+    for (const auto &block : m.content) {
+      if (auto *t = std::get_if<TextBlock>(&block))
+        text += t->text;
+      else if (std::holds_alternative<ToolUseBlock>(block))
+        has_calls = true;
+    }
+    out += R"(,{"role":"assistant")";
+    if (!text.empty()) {
+      out += R"(,"content":)";
+      append_json_string(out, text);
+    }
+    if (has_calls) {
+      out += R"(,"tool_calls":[)";
+      bool first = true;
+      for (const auto &block : m.content) {
+        auto *use = std::get_if<ToolUseBlock>(&block);
+        if (!use)
+          continue;
+        if (!first)
+          out += ',';
+        first = false;
+        out += R"({"id":)";
+        append_json_string(out, use->id);
+        out += R"(,"type":"function","function":{"name":)";
+        append_json_string(out, use->name);
+        out += R"(,"arguments":)";
+        append_json_string(out, boost::json::serialize(use->input));
+        out += "}}";
+      }
+      out += ']';
+    }
+    out += '}';
+  }
+  out += ']';
+}
+
+boost::json::value to_json(const Message &message) {
+  boost::json::object obj;
+  obj["role"] = json_view(role_name(message.role));
+  if (const TextBlock *text = single_text(message);
+      text && message.role == Role::user) {
+    obj["content"] = text->text;
+    return obj;
+  }
+  boost::json::array content;
+  content.reserve(message.content.size());
+  for (const auto &block : message.content) {
+    if (auto *t = std::get_if<TextBlock>(&block)) {
+      content.push_back({{"type", "text"}, {"text", t->text}});
+    } else if (auto *use = std::get_if<ToolUseBlock>(&block)) {
+      content.push_back({{"type", "tool_use"},
+                         {"id", json_view(use->id)},
+                         {"name", json_view(use->name)},
+                         {"input", use->input}});
+    } else if (auto *result = std::get_if<ToolResultBlock>(&block)) {
+      content.push_back({{"type", "tool_result"},
+                         {"tool_use_id", json_view(result->tool_use_id)},
+                         {"content", json_view(result->text())}});
+    }
+  }
+  obj["content"] = std::move(content);
+  return obj;
+}
+
+namespace {
+
+std::string_view string_field(const boost::json::object &obj,
+                              boost::json::string_view key) {
+  if (auto it = obj.find(key); it != obj.end() && it->value().is_string())
+    return view(it->value().get_string());
+  return {};
+}
+
+} // namespace
+
+namespace {
+
+// Shared by the copying and moving overloads. When `Json` is an rvalue, tool
+// inputs are moved out of `content` (keeping their storage) instead of being
+// deep-copied into `sp`.
+template <typename Json>
+std::vector<ContentBlock> blocks_from_json(Json &&content, Interner &interner,
+                                           const boost::json::storage_ptr &sp) {
+  constexpr bool movable = !std::is_const_v<std::remove_reference_t<Json>>;
+
+  std::vector<ContentBlock> blocks;
+  if (content.is_string()) {
+    blocks.push_back(TextBlock{std::string(view(content.get_string()))});
+    return blocks;
+  }
+  if (!content.is_array())
+    return blocks;
+
+  blocks.reserve(content.get_array().size());
+  for (auto &item_val : content.get_array()) {
+    if (!item_val.is_object())
+      continue;
+    auto &item = item_val.get_object();
+    std::string_view type = string_field(item, "type");
+    if (type == "text") {
+      blocks.push_back(TextBlock{std::string(string_field(item, "text"))});
+    } else if (type == "tool_use") {
+      // Move-assignment would keep the destination's storage and deep-copy,
+      // so the input is move-constructed instead.
+      auto input = [&]() -> boost::json::object {
+        auto it = item.find("input");
+        if (it == item.end() || !it->value().is_object())
+          return boost::json::object(sp);
+        if constexpr (movable)
+          return std::move(it->value().get_object());
+        else
+          return boost::json::object(it->value().get_object(), sp);
+      }();
+      blocks.push_back(ToolUseBlock{interner.intern(string_field(item, "id")),
+                                    interner.intern(string_field(item, "name")),
+                                    std::move(input)});
+    } else if (type == "tool_result") {
+      ToolResultBlock result{interner.intern(string_field(item, "tool_use_id")),
+                             {}};
+      // Anthropic also allows an array of text blocks here.
+      if (auto it = item.find("content"); it != item.end()) {
+        if (it->value().is_string()) {
+          result.content = view(it->value().get_string());
+        } else if (it->value().is_array()) {
+          for (const auto &part : it->value().get_array())
+            if (part.is_object())
+              result.content += string_field(part.get_object(), "text");
+        }
+      }
+      blocks.push_back(std::move(result));
+    }
+  }
+  return blocks;
+}
+
+} // namespace
+
+std::vector<ContentBlock>
+content_from_json(const boost::json::value &content, Interner &interner,
+                  const boost::json::storage_ptr &sp) {
+  return blocks_from_json(content, interner, sp);
+}
+
+std::vector<ContentBlock>
+content_from_json(boost::json::value &&content, Interner &interner,
+                  const boost::json::storage_ptr &sp) {
+  return blocks_from_json(std::move(content), interner, sp);
+}
+
+std::expected<Message, std::string>
+message_from_json(const boost::json::value &value, Interner &interner,
+                  const boost::json::storage_ptr &sp) {
+  if (!value.is_object())
+    return std::unexpected("message is not an object");
+  const auto &obj = value.get_object();
+  std::string_view role = string_field(obj, "role");
+  Message message;
+  if (role == "user")
+    message.role = Role::user;
+  else if (role == "assistant")
+    message.role = Role::assistant;
+  else
+    return std::unexpected("unknown role '" + std::string(role) + "'");
+
+  if (auto it = obj.find("content"); it != obj.end())
+    message.content = content_from_json(it->value(), interner, sp);
+  return message;
+}
+
+} // namespace agent
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <boost/json.hpp>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+namespace agent {
+
+// Deduplicating string pool for tool names and tool-call IDs. Every ID
+// appears at least twice (tool_use and tool_result) and names repeat across
+// the whole session, so blocks hold views into the pool instead of owning
+// copies. Views stay valid for the lifetime of the Interner.
+class Interner {
+public:
+  std::string_view intern(std::string_view s);
+
+private:
+  struct Hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const {
+      return std::hash<std::string_view>{}(s);
+    }
+  };
+  std::unordered_set<std::string, Hash, std::equal_to<>> strings_;
+};
+
+struct TextBlock {
+  std::string text;
+};
+
+struct ToolUseBlock {
+  std::string_view id;
+  std::string_view name;
+  boost::json::object input;
+};
+
+struct ToolResultBlock {
+  std::string_view tool_use_id;
+  // Where the text is held is not part of the message's value: a cold
+  // result may be moved out of RAM (see SpillFile) after the message is in
+  // a History, whose nodes are shared between branches and only reachable
+  // as const. `content` is then empty, `spilled` views the stored bytes and
+  // `spill_owner` keeps them mapped; text() is the same either way.
+  mutable std::string content;
+  mutable std::string_view spilled;
+  mutable std::shared_ptr<const void> spill_owner;
+
+  std::string_view text() const {
+    return spill_owner ? spilled : std::string_view(content);
+  }
+};
+
+using ContentBlock = std::variant<TextBlock, ToolUseBlock, ToolResultBlock>;
+
+enum class Role : std::uint8_t { user, assistant };
+
+struct Message {
+  Role role = Role::user;
+  std::vector<ContentBlock> content;
+};
+
+// Appends `s` as a quoted, escaped JSON string.
+void append_json_string(std::string &out, std::string_view s);
+
+// Direct wire-format serializers. They append the value of the "messages"
+// field (a JSON array) without building an intermediate DOM.
+// `cache_breakpoints` are message indices whose last block gets an
+// Anthropic prompt-cache breakpoint.
+void write_anthropic_messages(
+    std::string &out, std::span<const Message *const> messages,
+    std::span<const std::size_t> cache_breakpoints = {});
+void write_openai_messages(std::string &out, std::string_view system_prompt,
+                           std::span<const Message *const> messages);
+
+// Conversions to and from the Anthropic-style JSON used by /save and /load
+// and by Anthropic responses. Tool inputs are stored with `sp`.
+boost::json::value to_json(const Message &message);
+std::expected<Message, std::string>
+message_from_json(const boost::json::value &value, Interner &interner,
+                  const boost::json::storage_ptr &sp);
+std::vector<ContentBlock>
+content_from_json(const boost::json::value &content, Interner &interner,
+                  const boost::json::storage_ptr &sp);
+// Moves tool inputs out of `content` instead of copying them into `sp`; they
+// keep `content`'s storage.
+std::vector<ContentBlock>
+content_from_json(boost::json::value &&content, Interner &interner,
+                  const boost::json::storage_ptr &sp);
+
+} // namespace agent
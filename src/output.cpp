@@ -0,0 +1,121 @@
+#include "output.hpp"
+#include "trace.hpp"
+
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+
+namespace term {
+
+using steady = std::chrono::steady_clock;
+
+Output::Output(int fd) : fd_(fd) { set_frame_rate(60); }
+
+void Output::set_frame_rate(unsigned fps) {
+  if (fps == 0)
+    fps = 1;
+  frame_ = steady::duration(std::chrono::seconds(1)) / fps;
+}
+
+void Output::attach(boost::asio::any_io_executor executor) {
+  timer_.emplace(executor);
+  timer_armed_ = false;
+}
+
+void Output::detach() {
+  flush();
+  timer_.reset();
+  timer_armed_ = false;
+}
+
+void Output::write(std::string_view s) {
+  if (s.empty())
+    return;
+  buffer_.append(s);
+
+  if (buffer_.size() - head_ > max_pending_) {
+    flush();
+    return;
+  }
+  if (steady::now() - last_flush_ >= frame_)
+    flush_ready();
+  else
+    schedule();
+}
+
+bool Output::write_frame(std::string_view s) {
+  if (pending())
+    return false;
+  write(s);
+  return true;
+}
+
+void Output::flush() {
+  trace::Span span("flush", trace::Track::output);
+  while (pending()) {
+    ssize_t n = ::write(fd_, buffer_.data() + head_, buffer_.size() - head_);
+    ++write_calls_;
+    if (n < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      break;
+    }
+    consume(static_cast<std::size_t>(n));
+  }
+  buffer_.clear();
+  head_ = 0;
+  last_flush_ = steady::now();
+  congested_ = false;
+}
+
+void Output::flush_ready() {
+  if (!pending())
+    return;
+
+  if (congested_) {
+    pollfd pfd{fd_, POLLOUT, 0};
+    if (::poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLOUT)) {
+      last_flush_ = steady::now();
+      schedule();
+      return;
+    }
+  }
+
+  trace::Span span("write", trace::Track::output);
+  auto start = steady::now();
+  ssize_t n = ::write(fd_, buffer_.data() + head_, buffer_.size() - head_);
+  ++write_calls_;
+  last_flush_ = steady::now();
+  congested_ = last_flush_ - start > frame_;
+  if (n > 0)
+    consume(static_cast<std::size_t>(n));
+  if (pending())
+    schedule();
+}
+
+void Output::schedule() {
+  if (!timer_ || timer_armed_)
+    return;
+  timer_armed_ = true;
+  timer_->expires_at(last_flush_ + frame_);
+  timer_->async_wait([this](const boost::system::error_code &ec) {
+    timer_armed_ = false;
+    if (!ec)
+      flush_ready();
+  });
+}
+
+void Output::consume(std::size_t n) {
+  head_ += n;
+  if (head_ >= buffer_.size()) {
+    buffer_.clear();
+    head_ = 0;
+  }
+}
+
+Output &out() {
+  static Output instance(STDOUT_FILENO);
+  return instance;
+}
+
+} // namespace term
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace term {
+
+// Frame-paced terminal writer.
+//
+// Writes are appended to a buffer and handed to the kernel at most once per
+// frame with a single write(2). A timer on the attached executor flushes the
+// trailing edge of a burst. Once a write takes longer than a frame the
+// terminal is treated as congested and later flushes poll for writability
+// first, so a slow terminal delays output instead of stalling the network
+// coroutine. Only a buffer beyond `max_pending` forces a blocking drain.
+class Output {
+public:
+  explicit Output(int fd);
+
+  void set_frame_rate(unsigned fps);
+
+  // Enables trailing-edge flushes driven by a timer on `executor`.
+  void attach(boost::asio::any_io_executor executor);
+
+  // Flushes and drops the timer; must run before the executor's context is
+  // destroyed.
+  void detach();
+
+  // Queues `s` for output.
+  void write(std::string_view s);
+
+  // Writes a transient frame (e.g. a spinner) only if nothing else is
+  // pending. Returns false if the frame was dropped.
+  bool write_frame(std::string_view s);
+
+  // Blocks until everything queued has been written. Call before handing
+  // the terminal to another writer (replxx, std::cout).
+  void flush();
+
+  bool pending() const { return head_ < buffer_.size(); }
+  std::size_t write_calls() const { return write_calls_; }
+
+private:
+  void flush_ready();
+  void schedule();
+  void consume(std::size_t n);
+
+  int fd_;
+  std::chrono::steady_clock::duration frame_;
+  std::chrono::steady_clock::time_point last_flush_{};
+  std::string buffer_;
+  std::size_t head_ = 0;
+  std::size_t max_pending_ = 8 * 1024 * 1024;
+  bool congested_ = false;
+  std::optional<boost::asio::steady_timer> timer_;
+  bool timer_armed_ = false;
+  std::size_t write_calls_ = 0;
+};
+
+// Process-wide writer for stdout.
+Output &out();
+
+} // namespace term
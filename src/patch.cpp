@@ -0,0 +1,351 @@
+#include "patch.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <iterator>
+#include <optional>
+
+namespace tools {
+
+namespace {
+
+// Context lines GNU patch-style fuzz may drop from each end of a hunk.
+constexpr std::size_t max_fuzz = 2;
+// Longest excerpt of a line quoted in a rejection message.
+constexpr std::size_t quoted_line_bytes = 120;
+
+std::vector<std::string_view> split(std::string_view text) {
+  std::vector<std::string_view> lines;
+  for (std::size_t pos = 0; pos < text.size();) {
+    std::size_t end = std::min(text.find('\n', pos), text.size());
+    lines.push_back(text.substr(pos, end - pos));
+    pos = end + 1;
+  }
+  return lines;
+}
+
+std::string_view strip_cr(std::string_view line) {
+  if (line.ends_with('\r'))
+    line.remove_suffix(1);
+  return line;
+}
+
+std::string_view trim_end(std::string_view line) {
+  std::size_t end = line.find_last_not_of(" \t\r");
+  return end == std::string_view::npos ? std::string_view{}
+                                       : line.substr(0, end + 1);
+}
+
+std::string clean_path(std::string_view raw) {
+  // Drop the timestamp diff(1) appends after a tab.
+  raw = raw.substr(0, raw.find('\t'));
+  raw = trim_end(raw);
+  raw.remove_prefix(std::min(raw.find_first_not_of(' '), raw.size()));
+  if (raw == "/dev/null")
+    return {};
+  return std::string(raw);
+}
+
+std::string quote(std::string_view line) {
+  line = strip_cr(line);
+  if (line.size() <= quoted_line_bytes)
+    return std::format("\"{}\"", line);
+  return std::format("\"{}...\"", line.substr(0, quoted_line_bytes));
+}
+
+bool parse_hunk_header(std::string_view line, long long &old_start) {
+  // "@@ -a,b +c,d @@ optional section name"
+  std::size_t minus = line.find('-');
+  if (minus == std::string_view::npos)
+    return false;
+  const char *first = line.data() + minus + 1;
+  auto [ptr, ec] = std::from_chars(first, line.data() + line.size(), old_start);
+  return ec == std::errc() && ptr != first;
+}
+
+enum class Compare { exact, trailing_whitespace };
+
+bool same(std::string_view file_line, std::string_view want, Compare mode) {
+  if (mode == Compare::exact)
+    return strip_cr(file_line) == strip_cr(want);
+  return trim_end(file_line) == trim_end(want);
+}
+
+// Position of `want` in `lines` at or after `from`, nearest to `hint`.
+std::optional<std::size_t> locate(const std::vector<std::string_view> &lines,
+                                  const std::vector<std::string_view> &want,
+                                  std::size_t from, std::size_t hint,
+                                  Compare mode) {
+  if (from + want.size() > lines.size())
+    return std::nullopt;
+  std::size_t last = lines.size() - want.size();
+  hint = std::clamp(hint, from, last);
+  if (want.empty())
+    return hint;
+  auto matches = [&](std::size_t pos) {
+    for (std::size_t j = 0; j < want.size(); ++j)
+      if (!same(lines[pos + j], want[j], mode))
+        return false;
+    return true;
+  };
+  for (std::size_t d = 0; hint + d <= last || hint >= from + d; ++d) {
+    if (hint + d <= last && matches(hint + d))
+      return hint + d;
+    if (d > 0 && hint >= from + d && matches(hint - d))
+      return hint - d;
+  }
+  return std::nullopt;
+}
+
+// Why `want` could not be placed: the position after `from` that matches
+// the most leading lines, and the first line that differs there.
+std::string explain_miss(const std::vector<std::string_view> &lines,
+                         const std::vector<std::string_view> &want,
+                         std::size_t from, std::size_t hint) {
+  auto distance = [hint](std::size_t p) {
+    return p > hint ? p - hint : hint - p;
+  };
+  std::size_t best = 0, best_pos = 0;
+  for (std::size_t pos = from; pos < lines.size(); ++pos) {
+    std::size_t run = 0;
+    while (run < want.size() && pos + run < lines.size() &&
+           same(lines[pos + run], want[run], Compare::trailing_whitespace))
+      ++run;
+    if (run > best ||
+        (run == best && run > 0 && distance(pos) < distance(best_pos))) {
+      best = run;
+      best_pos = pos;
+    }
+  }
+  if (best == 0)
+    return std::format("first line {} does not appear after line {}",
+                       quote(want.front()), from);
+  if (best_pos + best >= lines.size())
+    return std::format("closest match at line {} runs past the end of the "
+                       "file after {} of {} lines",
+                       best_pos + 1, best, want.size());
+  return std::format("closest match at line {} differs at line {}: "
+                     "expected {}, found {}",
+                     best_pos + 1, best_pos + best + 1, quote(want[best]),
+                     quote(lines[best_pos + best]));
+}
+
+} // namespace
+
+std::expected<std::vector<FilePatch>, std::string>
+parse_patch(std::string_view patch) {
+  std::vector<FilePatch> files;
+  auto lines = split(patch);
+  Hunk *hunk = nullptr;
+  // Bare empty lines seen in a hunk but not yet known to be part of it.
+  std::size_t blanks = 0;
+  for (std::size_t i = 0; i < lines.size(); ++i) {
+    std::string_view line = strip_cr(lines[i]);
+    if (line.starts_with("--- ") && i + 1 < lines.size() &&
+        lines[i + 1].starts_with("+++ ")) {
+      FilePatch file{clean_path(line.substr(4)),
+                     clean_path(strip_cr(lines[i + 1]).substr(4)),
+                     {}};
+      // git's a/ and b/ prefixes, only when both sides follow the scheme.
+      bool prefixed =
+          (file.old_path.empty() || file.old_path.starts_with("a/")) &&
+          (file.new_path.empty() || file.new_path.starts_with("b/"));
+      if (prefixed) {
+        if (!file.old_path.empty())
+          file.old_path.erase(0, 2);
+        if (!file.new_path.empty())
+          file.new_path.erase(0, 2);
+      }
+      if (file.old_path.empty() && file.new_path.empty())
+        return std::unexpected("file header names /dev/null on both sides");
+      files.push_back(std::move(file));
+      hunk = nullptr;
+      blanks = 0;
+      ++i;
+      continue;
+    }
+    if (line.starts_with("@@")) {
+      if (files.empty())
+        return std::unexpected("hunk before any ---/+++ file header");
+      Hunk next;
+      next.header = line;
+      if (!parse_hunk_header(line, next.old_start))
+        return std::unexpected(std::format("malformed hunk header: {}", line));
+      files.back().hunks.push_back(std::move(next));
+      hunk = &files.back().hunks.back();
+      blanks = 0;
+      continue;
+    }
+    if (!hunk)
+      continue; // "diff --git", "index", mode lines, prose
+    if (line.empty()) {
+      // Editors and models often strip the space from blank context, but
+      // blank lines may also just pad the end of the patch.
+      ++blanks;
+    } else if (line[0] == ' ' || line[0] == '-' || line[0] == '+') {
+      for (; blanks > 0; --blanks)
+        hunk->lines.push_back({' ', ""});
+      hunk->lines.push_back({line[0], line.substr(1)});
+    } else if (line[0] == '\\') {
+      char last = hunk->lines.empty() ? ' ' : hunk->lines.back().first;
+      if (last != '+')
+        hunk->old_no_newline = true;
+      if (last != '-')
+        hunk->new_no_newline = true;
+    } else {
+      hunk = nullptr;
+    }
+  }
+
+  for (auto &file : files) {
+    for (const auto &h : file.hunks) {
+      if (h.lines.empty())
+        return std::unexpected(std::format("empty hunk in {}: {}",
+                                           file.new_path.empty()
+                                               ? file.old_path
+                                               : file.new_path,
+                                           h.header));
+    }
+    if (file.hunks.empty() && !file.new_path.empty() && !file.old_path.empty())
+      return std::unexpected("no hunks for " + file.new_path);
+  }
+  if (files.empty())
+    return std::unexpected("no ---/+++ file headers found");
+  return files;
+}
+
+std::vector<std::string> patch_paths(std::string_view patch) {
+  std::vector<std::string> paths;
+  auto files = parse_patch(patch);
+  if (!files)
+    return paths;
+  for (const auto &file : *files)
+    for (const auto *path : {&file.old_path, &file.new_path})
+      if (!path->empty() && std::ranges::find(paths, *path) == paths.end())
+        paths.push_back(*path);
+  return paths;
+}
+
+std::expected<std::string, std::string>
+apply_file_patch(std::string_view text, const FilePatch &file,
+                 std::vector<std::string> &notes) {
+  auto lines = split(text);
+  // A new or empty file ends with a newline unless the patch says not to.
+  bool newline_at_end = text.empty() || text.ends_with('\n');
+  bool crlf = !lines.empty() && lines.front().ends_with('\r');
+
+  std::string out;
+  std::string rejects;
+  std::size_t copied = 0;
+  // How far the file has drifted from the hunk headers so far.
+  long long shift = 0;
+  for (std::size_t k = 0; k < file.hunks.size(); ++k) {
+    const Hunk &hunk = file.hunks[k];
+    std::size_t leading = 0, trailing = 0;
+    while (leading < hunk.lines.size() && hunk.lines[leading].first == ' ')
+      ++leading;
+    while (trailing < hunk.lines.size() - leading &&
+           hunk.lines[hunk.lines.size() - 1 - trailing].first == ' ')
+      ++trailing;
+
+    // A hunk without old lines inserts after the line its header names;
+    // otherwise the header names its first line.
+    bool inserts_only = std::ranges::all_of(
+        hunk.lines, [](const auto &line) { return line.first == '+'; });
+    long long first_line = hunk.old_start - (inserts_only ? 0 : 1);
+
+    std::optional<std::size_t> pos;
+    std::size_t fuzz = 0, skip = 0, keep = hunk.lines.size();
+    Compare mode = Compare::exact;
+    std::vector<std::string_view> want;
+    std::size_t expected = 0;
+    for (; fuzz <= max_fuzz; ++fuzz) {
+      // Past the context there is on either end, more fuzz drops nothing.
+      if (fuzz > 0 && fuzz > leading && fuzz > trailing)
+        break;
+      skip = std::min(fuzz, leading);
+      keep = hunk.lines.size() - std::min(fuzz, trailing);
+      want.clear();
+      for (std::size_t j = skip; j < keep; ++j)
+        if (hunk.lines[j].first != '+')
+          want.push_back(hunk.lines[j].second);
+      // Fuzz never leaves a hunk with nothing to anchor it.
+      if (fuzz > 0 && want.empty())
+        break;
+      expected = static_cast<std::size_t>(std::max(
+          0LL, first_line + static_cast<long long>(skip) + shift));
+      for (auto m : {Compare::exact, Compare::trailing_whitespace}) {
+        mode = m;
+        if ((pos = locate(lines, want, copied, expected, mode)))
+          break;
+      }
+      if (pos)
+        break;
+    }
+    if (!pos) {
+      std::vector<std::string_view> full;
+      for (const auto &[tag, line] : hunk.lines)
+        if (tag != '+')
+          full.push_back(line);
+      std::size_t hint = static_cast<std::size_t>(
+          std::max(0LL, first_line + shift));
+      std::format_to(std::back_inserter(rejects), "\n  hunk {} ({}): {}", k + 1,
+                     hunk.header,
+                     full.empty() ? std::string("nothing to anchor it to")
+                                  : explain_miss(lines, full, copied, hint));
+      continue;
+    }
+
+    for (; copied < *pos; ++copied) {
+      out.append(lines[copied]);
+      out += '\n';
+    }
+    for (std::size_t j = skip; j < keep; ++j) {
+      auto [tag, line] = hunk.lines[j];
+      if (tag == ' ') {
+        // Context keeps the file's own text, whitespace and all.
+        out.append(lines[copied++]);
+        out += '\n';
+      } else if (tag == '-') {
+        ++copied;
+      } else {
+        out.append(line);
+        if (crlf)
+          out += '\r';
+        out += '\n';
+      }
+    }
+    if (copied == lines.size()) {
+      if (hunk.new_no_newline)
+        newline_at_end = false;
+      else if (hunk.old_no_newline)
+        newline_at_end = true;
+    }
+
+    long long offset =
+        static_cast<long long>(*pos) - static_cast<long long>(expected);
+    shift += offset;
+    std::string how;
+    if (offset != 0)
+      how += std::format(" at line {} (offset {:+})", *pos + 1, offset);
+    if (mode == Compare::trailing_whitespace)
+      how += " ignoring trailing whitespace";
+    if (fuzz > 0)
+      how += std::format(" with fuzz {}", fuzz);
+    if (!how.empty())
+      notes.push_back(std::format("hunk {} applied{}", k + 1, how));
+  }
+  if (!rejects.empty())
+    return std::unexpected(std::format("rejected:{}", rejects));
+
+  for (; copied < lines.size(); ++copied) {
+    out.append(lines[copied]);
+    out += '\n';
+  }
+  if (!newline_at_end && out.ends_with('\n'))
+    out.pop_back();
+  return out;
+}
+
+} // namespace tools
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <expected>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tools {
+
+struct Hunk {
+  // The "@@ -a,b +c,d @@" line, for messages.
+  std::string_view header;
+  // 1-based line the hunk expects to start at in the old file.
+  long long old_start = 0;
+  // Lines without their newline, tagged ' ', '-' or '+'.
+  std::vector<std::pair<char, std::string_view>> lines;
+  // "\ No newline at end of file" after the last old / new line.
+  bool old_no_newline = false;
+  bool new_no_newline = false;
+};
+
+// One file's section of a unified diff. A path is empty for /dev/null, so
+// a created file has no old_path and a deleted one no new_path.
+struct FilePatch {
+  std::string old_path;
+  std::string new_path;
+  std::vector<Hunk> hunks;
+};
+
+// Parses a unified diff (plain or git style; a/ and b/ prefixes are
+// dropped). Hunk line counts are not trusted, since models often get them
+// wrong: a hunk runs until the next hunk or file header. The result views
+// into `patch`.
+std::expected<std::vector<FilePatch>, std::string>
+parse_patch(std::string_view patch);
+
+// Paths a patch creates, changes or removes, for checkpointing before it
+// is applied; empty if it does not parse.
+std::vector<std::string> patch_paths(std::string_view patch);
+
+// Applies `file`'s hunks to `text`. Each hunk is looked for nearest the
+// line its header names, after the previous hunk, first exactly, then
+// ignoring trailing whitespace and line endings, then with up to two
+// context lines dropped from either end. Context lines keep the file's own
+// text. `notes` receives a line for each hunk that needed any of that; on
+// failure the error lists every hunk that could not be placed.
+std::expected<std::string, std::string>
+apply_file_patch(std::string_view text, const FilePatch &file,
+                 std::vector<std::string> &notes);
+
+} // namespace tools
@@ -0,0 +1,449 @@
+#include "repo_map.hpp"
+#include "tools.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string_view>
+#include <sys/stat.h>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+namespace agent {
+
+namespace {
+
+constexpr std::string_view cache_magic = "nanocode-repomap 1";
+// Trees larger than this are mapped partially.
+constexpr std::size_t max_files = 20000;
+// Larger files are generated or vendored more often than not.
+constexpr std::uint64_t max_scan_size = 256 * 1024;
+constexpr std::size_t max_symbols_per_file = 64;
+constexpr std::size_t shown_symbols_per_file = 24;
+constexpr std::size_t max_directory_lines = 48;
+// Rough size of a token, for the budget.
+constexpr std::size_t bytes_per_token = 4;
+
+bool skip_directory(const fs::path &dir) {
+  std::string name = dir.filename().string();
+  if (name.starts_with('.') || name == "node_modules" ||
+      name == "__pycache__" || name == "target" || name == "dist" ||
+      name == "build" || name == "vendor" || name == "venv")
+    return true;
+  // Out-of-tree build directories, whatever they are called.
+  std::error_code ec;
+  return fs::exists(dir / "CMakeCache.txt", ec);
+}
+
+bool is_ident_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == '$';
+}
+
+std::string_view ident(std::string_view s) {
+  std::size_t n = 0;
+  while (n < s.size() && is_ident_char(s[n]))
+    ++n;
+  return s.substr(0, n);
+}
+
+bool strip(std::string_view &line, std::string_view prefix) {
+  if (!line.starts_with(prefix))
+    return false;
+  line.remove_prefix(prefix.size());
+  while (!line.empty() && line.front() == ' ')
+    line.remove_prefix(1);
+  return true;
+}
+
+bool all_upper(std::string_view s) {
+  return std::ranges::none_of(s, [](char c) { return c >= 'a' && c <= 'z'; });
+}
+
+// Top-level C/C++ declarations start in column 0: types, and functions
+// that have a return type or a qualified name (macro invocations have
+// neither). Namespace bodies are not indented in most styles.
+void scan_c(std::string_view line, bool header, std::string_view &name) {
+  if (strip(line, "template")) {
+    std::size_t close = line.find('>');
+    if (close == std::string_view::npos)
+      return;
+    line.remove_prefix(close + 1);
+    while (!line.empty() && line.front() == ' ')
+      line.remove_prefix(1);
+  }
+  for (std::string_view kw : {"class ", "struct ", "union ", "enum class ",
+                              "enum struct ", "enum "}) {
+    if (strip(line, kw)) {
+      // Forward declarations name nothing new.
+      if (!line.ends_with(';') || line.contains('{'))
+        name = ident(line);
+      return;
+    }
+  }
+  for (std::string_view kw : {"namespace", "using ", "typedef ", "extern ",
+                              "return", "static_assert", "friend "})
+    if (line.starts_with(kw))
+      return;
+  std::size_t paren = line.find('(');
+  if (paren == std::string_view::npos)
+    return;
+  std::string_view head = line.substr(0, paren);
+  if (head.contains('=') || head.contains('"') || head.contains("operator"))
+    return;
+  while (!head.empty() && head.back() == ' ')
+    head.remove_suffix(1);
+  std::size_t begin = head.size();
+  while (begin > 0 && (is_ident_char(head[begin - 1]) ||
+                       head[begin - 1] == ':' || head[begin - 1] == '~'))
+    --begin;
+  std::string_view candidate = head.substr(begin);
+  while (candidate.starts_with(':'))
+    candidate.remove_prefix(1);
+  if (candidate.empty() || all_upper(candidate) ||
+      (begin == 0 && !candidate.contains("::")) ||
+      (!header && line.ends_with(';')))
+    return;
+  name = candidate;
+}
+
+void scan_python(std::string_view line, std::string_view &name) {
+  strip(line, "async ");
+  if (strip(line, "def ") || strip(line, "class "))
+    name = ident(line);
+}
+
+void scan_js(std::string_view line, std::string_view &name) {
+  bool exported = strip(line, "export ");
+  strip(line, "default ");
+  strip(line, "declare ");
+  strip(line, "async ");
+  strip(line, "abstract ");
+  if (strip(line, "function*") || strip(line, "function ") ||
+      strip(line, "class ") || strip(line, "interface ") ||
+      strip(line, "type ") || strip(line, "enum ") ||
+      (exported &&
+       (strip(line, "const ") || strip(line, "let ") || strip(line, "var "))))
+    name = ident(line);
+}
+
+void scan_go(std::string_view line, std::string &qualified,
+             std::string_view &name) {
+  if (strip(line, "type ")) {
+    name = ident(line);
+  } else if (strip(line, "func ")) {
+    if (!line.starts_with('(')) {
+      name = ident(line);
+      return;
+    }
+    // Methods: `func (s *Server) Start(` becomes Server.Start.
+    std::size_t close = line.find(')');
+    if (close == std::string_view::npos)
+      return;
+    std::string_view receiver = line.substr(1, close - 1);
+    receiver.remove_prefix(std::min(receiver.size(),
+                                    receiver.find_last_of(" *") + 1));
+    line.remove_prefix(close + 1);
+    while (!line.empty() && line.front() == ' ')
+      line.remove_prefix(1);
+    qualified = std::string(receiver) + "." + std::string(ident(line));
+    name = qualified;
+  }
+}
+
+void scan_rust(std::string_view line, std::string_view &name) {
+  if (!strip(line, "pub(crate) "))
+    strip(line, "pub ");
+  strip(line, "async ");
+  strip(line, "unsafe ");
+  if (strip(line, "fn ") || strip(line, "struct ") || strip(line, "enum ") ||
+      strip(line, "trait ") || strip(line, "type ") || strip(line, "union "))
+    name = ident(line);
+}
+
+std::vector<std::string> extract_symbols(const fs::path &path,
+                                         std::string_view ext) {
+  bool c_like = ext == ".c" || ext == ".cc" || ext == ".cpp" ||
+                ext == ".cxx" || ext == ".h" || ext == ".hh" ||
+                ext == ".hpp" || ext == ".hxx";
+  bool header = ext.starts_with(".h");
+  bool python = ext == ".py";
+  bool js = ext == ".js" || ext == ".jsx" || ext == ".ts" || ext == ".tsx" ||
+            ext == ".mjs";
+  bool go = ext == ".go";
+  bool rust = ext == ".rs";
+  std::vector<std::string> symbols;
+  if (!c_like && !python && !js && !go && !rust)
+    return symbols;
+
+  std::ifstream in(path, std::ios::binary);
+  std::string line;
+  std::string qualified;
+  while (symbols.size() < max_symbols_per_file && std::getline(in, line)) {
+    std::string_view view = line;
+    if (view.ends_with('\r'))
+      view.remove_suffix(1);
+    // Declarations start with a name; this also skips comments,
+    // preprocessor lines and indented code.
+    if (view.empty() || !(is_ident_char(view.front()) || view.front() == '~'))
+      continue;
+    std::string_view name;
+    if (c_like)
+      scan_c(view, header, name);
+    else if (python)
+      scan_python(view, name);
+    else if (js)
+      scan_js(view, name);
+    else if (go)
+      scan_go(view, qualified, name);
+    else
+      scan_rust(view, name);
+    // Overloads and declaration/definition pairs appear once.
+    if (!name.empty() && std::ranges::find(symbols, name) == symbols.end())
+      symbols.emplace_back(name);
+  }
+  return symbols;
+}
+
+std::uint64_t hash_entry(std::string_view path, std::uint64_t size,
+                         std::int64_t mtime_ns) {
+  std::uint64_t h = 14695981039346656037ull;
+  auto mix = [&](std::uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+      h ^= (v >> (i * 8)) & 0xff;
+      h *= 1099511628211ull;
+    }
+  };
+  for (char c : path) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 1099511628211ull;
+  }
+  mix(size);
+  mix(static_cast<std::uint64_t>(mtime_ns));
+  return h;
+}
+
+bool is_key_file(std::string_view name) {
+  return name.starts_with("README") || name.starts_with("CONTRIBUTING") ||
+         name == "AGENTS.md" || name == "CMakeLists.txt" ||
+         name == "Makefile" || name == "meson.build" ||
+         name == "package.json" || name == "Cargo.toml" ||
+         name == "pyproject.toml" || name == "setup.py" || name == "go.mod" ||
+         name == "BUILD" || name == "BUILD.bazel" || name == "WORKSPACE";
+}
+
+} // namespace
+
+RepoMap::RepoMap(fs::path root, fs::path cache_path)
+    : root_(std::move(root)), cache_path_(std::move(cache_path)) {}
+
+bool RepoMap::update() {
+  if (!cache_loaded_)
+    load_cache();
+
+  std::unordered_map<std::string, File> next;
+  std::uint64_t fingerprint = 0;
+  std::error_code ec;
+  for (fs::recursive_directory_iterator it(
+           root_, fs::directory_options::skip_permission_denied, ec);
+       !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    if (it->is_directory(ec)) {
+      if (skip_directory(it->path()))
+        it.disable_recursion_pending();
+      continue;
+    }
+    struct stat st;
+    std::string name = it->path().filename().string();
+    if (name.starts_with('.') || ::stat(it->path().c_str(), &st) != 0 ||
+        !S_ISREG(st.st_mode))
+      continue;
+    std::string rel = it->path().lexically_relative(root_).generic_string();
+    if (rel.find_first_of("\t\n") != std::string::npos)
+      continue;
+    if (next.size() == max_files)
+      break;
+#if defined(__APPLE__)
+    const auto &mtime = st.st_mtimespec;
+#else
+    const auto &mtime = st.st_mtim;
+#endif
+    File file{static_cast<std::uint64_t>(st.st_size),
+              static_cast<std::int64_t>(mtime.tv_sec) * 1000000000 +
+                  mtime.tv_nsec,
+              {}};
+    fingerprint += hash_entry(rel, file.size, file.mtime_ns);
+    if (auto old = files_.find(rel); old != files_.end() &&
+                                     old->second.size == file.size &&
+                                     old->second.mtime_ns == file.mtime_ns)
+      file.symbols = std::move(old->second.symbols);
+    else if (file.size <= max_scan_size)
+      file.symbols = extract_symbols(it->path(), it->path().extension().string());
+    next.emplace(std::move(rel), std::move(file));
+  }
+
+  files_ = std::move(next);
+  if (fingerprint == fingerprint_)
+    return false;
+  fingerprint_ = fingerprint;
+  save_cache();
+  return true;
+}
+
+void RepoMap::load_cache() {
+  cache_loaded_ = true;
+  std::ifstream in(cache_path_, std::ios::binary);
+  std::string line;
+  if (!std::getline(in, line) || !line.starts_with(cache_magic))
+    return;
+  fingerprint_ = std::strtoull(line.c_str() + cache_magic.size(), nullptr, 10);
+  while (std::getline(in, line)) {
+    std::vector<std::string_view> fields;
+    std::string_view rest = line;
+    while (true) {
+      std::size_t tab = rest.find('\t');
+      fields.push_back(rest.substr(0, tab));
+      if (tab == std::string_view::npos)
+        break;
+      rest.remove_prefix(tab + 1);
+    }
+    if (fields.size() < 3)
+      continue;
+    File file;
+    file.size = std::strtoull(std::string(fields[1]).c_str(), nullptr, 10);
+    file.mtime_ns = std::strtoll(std::string(fields[2]).c_str(), nullptr, 10);
+    for (std::size_t i = 3; i < fields.size(); ++i)
+      file.symbols.emplace_back(fields[i]);
+    files_.emplace(std::string(fields[0]), std::move(file));
+  }
+}
+
+void RepoMap::save_cache() const {
+  std::error_code ec;
+  tools::create_state_dir(cache_path_.parent_path());
+  fs::path tmp = cache_path_;
+  tmp += ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return;
+    out << cache_magic << ' ' << fingerprint_ << '\n';
+    for (const auto &[path, file] : files_) {
+      out << path << '\t' << file.size << '\t' << file.mtime_ns;
+      for (const auto &symbol : file.symbols)
+        out << '\t' << symbol;
+      out << '\n';
+    }
+    if (!out)
+      return;
+  }
+  // Concurrent sessions in the same tree each write a whole file.
+  fs::rename(tmp, cache_path_, ec);
+}
+
+std::size_t RepoMap::memory_bytes() const {
+  std::size_t bytes = 0;
+  for (const auto &[path, file] : files_) {
+    bytes += sizeof(std::string) + path.capacity() + sizeof(File) +
+             2 * sizeof(void *) + file.symbols.capacity() * sizeof(std::string);
+    for (const auto &symbol : file.symbols)
+      bytes += symbol.capacity();
+  }
+  return bytes;
+}
+
+std::string RepoMap::render(std::size_t budget_tokens) const {
+  std::size_t budget = budget_tokens * bytes_per_token;
+  if (files_.empty() || budget == 0)
+    return {};
+
+  struct DirSummary {
+    std::size_t files = 0;
+    std::map<std::string, std::size_t> extensions;
+  };
+  std::map<std::string, DirSummary> dirs;
+  std::vector<std::string_view> key_files;
+  std::vector<const std::pair<const std::string, File> *> sources;
+  for (const auto &entry : files_) {
+    fs::path path(entry.first);
+    fs::path parent = path.parent_path();
+    // Counted under each of their first two directory levels.
+    fs::path prefix;
+    int depth = 0;
+    for (const auto &part : parent) {
+      if (++depth > 2)
+        break;
+      prefix /= part;
+      DirSummary &summary = dirs[prefix.generic_string() + "/"];
+      ++summary.files;
+      if (path.has_extension())
+        ++summary.extensions[path.extension().string()];
+    }
+    if (depth <= 1 && is_key_file(path.filename().string()))
+      key_files.push_back(entry.first);
+    if (!entry.second.symbols.empty())
+      sources.push_back(&entry);
+  }
+  auto depth = [](std::string_view path) {
+    return std::ranges::count(path, '/');
+  };
+  std::ranges::sort(key_files);
+  std::ranges::sort(sources, [&](const auto *a, const auto *b) {
+    return std::pair(depth(a->first), std::string_view(a->first)) <
+           std::pair(depth(b->first), std::string_view(b->first));
+  });
+
+  std::string out = "Repository map (" + std::to_string(files_.size()) +
+                    " files, taken at session start; files changed since "
+                    "may differ):\n";
+  if (!dirs.empty()) {
+    out += "Directories:\n";
+    std::size_t lines = 0;
+    for (const auto &[dir, summary] : dirs) {
+      if (++lines > max_directory_lines || out.size() > budget / 3) {
+        out += "  ...\n";
+        break;
+      }
+      std::vector<std::pair<std::size_t, std::string_view>> exts;
+      for (const auto &[ext, count] : summary.extensions)
+        exts.emplace_back(count, ext);
+      std::ranges::sort(exts, std::greater<>());
+      out += "  " + dir + " " + std::to_string(summary.files) + " files";
+      for (std::size_t i = 0; i < exts.size() && i < 3; ++i)
+        out += (i ? ", " : " (") + std::string(exts[i].second) + " " +
+               std::to_string(exts[i].first);
+      out += exts.empty() ? "\n" : ")\n";
+    }
+  }
+  if (!key_files.empty()) {
+    out += "Key files:";
+    for (std::size_t i = 0; i < key_files.size(); ++i)
+      out += (i ? ", " : " ") + std::string(key_files[i]);
+    out += '\n';
+  }
+
+  if (!sources.empty())
+    out += "Symbols:\n";
+  std::size_t shown = 0;
+  for (const auto *entry : sources) {
+    const auto &symbols = entry->second.symbols;
+    std::string line = "  " + entry->first + ":";
+    for (std::size_t i = 0; i < symbols.size() && i < shown_symbols_per_file;
+         ++i)
+      line += (i ? ", " : " ") + symbols[i];
+    if (symbols.size() > shown_symbols_per_file)
+      line += ", ...";
+    line += '\n';
+    if (out.size() + line.size() > budget)
+      break;
+    out += line;
+    ++shown;
+  }
+  if (shown < sources.size())
+    out += "  (" + std::to_string(sources.size() - shown) +
+           " more source files not shown)\n";
+  return out;
+}
+
+} // namespace agent
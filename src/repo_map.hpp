@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace agent {
+
+// Compact map of the working tree for the system prompt: a directory
+// summary, the build and readme files, and the top-level symbols of each
+// source file. Symbols are extracted with a per-language line scanner and
+// cached on disk by file (size, mtime), so a rescan only re-reads files that
+// changed; the cache is rewritten only when the tree fingerprint moves.
+class RepoMap {
+public:
+  // Maps the tree under `root`; the symbol cache is kept at `cache_path`.
+  RepoMap(std::filesystem::path root, std::filesystem::path cache_path);
+
+  // Rescans the tree. Returns true if anything changed since the last scan.
+  bool update();
+
+  // The map in at most about `budget_tokens` tokens; empty if the tree has
+  // no files. Directories and key files come first, then symbols, shallower
+  // files first.
+  std::string render(std::size_t budget_tokens) const;
+
+  std::size_t files() const { return files_.size(); }
+  std::uint64_t fingerprint() const { return fingerprint_; }
+  // Approximate heap bytes held by the scanned entries.
+  std::size_t memory_bytes() const;
+
+private:
+  struct File {
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+    std::vector<std::string> symbols;
+  };
+
+  void load_cache();
+  void save_cache() const;
+
+  std::filesystem::path root_;
+  std::filesystem::path cache_path_;
+  bool cache_loaded_ = false;
+  // Relative path -> entry.
+  std::unordered_map<std::string, File> files_;
+  std::uint64_t fingerprint_ = 0;
+};
+
+} // namespace agent
@@ -0,0 +1,494 @@
+#include "session_index.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace agent {
+
+namespace {
+
+using TermCounts = std::map<std::string, std::uint32_t, std::less<>>;
+
+bool is_word_char(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+bool is_space(unsigned char c) {
+  return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' ||
+         c == '\v';
+}
+
+std::string lowercase(std::string_view s) {
+  std::string out(s);
+  for (char &c : out)
+    if (c >= 'A' && c <= 'Z')
+      c = static_cast<char>(c - 'A' + 'a');
+  return out;
+}
+
+void add_path_term(TermCounts &terms, std::string_view s) {
+  while (!s.empty() && std::string_view("\"'`([{<,;:").contains(s.front()))
+    s.remove_prefix(1);
+  while (!s.empty() && std::string_view("\"'`)]}>,;:.").contains(s.back()))
+    s.remove_suffix(1);
+  // Tabs and newlines would break the record format; only a path field
+  // taken whole can still contain them.
+  if (s.size() >= 2 && s.size() <= 256 &&
+      s.find_first_of("\t\n") == std::string_view::npos)
+    ++terms[lowercase(s)];
+}
+
+// Words are runs of [A-Za-z0-9_]; anything whitespace-delimited containing
+// a '/' is additionally kept whole so full paths match exactly.
+void tokenize(std::string_view s, TermCounts &terms) {
+  std::size_t i = 0;
+  while (i < s.size()) {
+    while (i < s.size() && is_space(s[i]))
+      ++i;
+    std::size_t start = i;
+    while (i < s.size() && !is_space(s[i]))
+      ++i;
+    std::string_view chunk = s.substr(start, i - start);
+    if (chunk.contains('/'))
+      add_path_term(terms, chunk);
+    std::size_t j = 0;
+    while (j < chunk.size()) {
+      while (j < chunk.size() && !is_word_char(chunk[j]))
+        ++j;
+      std::size_t w = j;
+      while (j < chunk.size() && is_word_char(chunk[j]))
+        ++j;
+      if (j - w >= 2 && j - w <= 64)
+        ++terms[lowercase(chunk.substr(w, j - w))];
+    }
+  }
+}
+
+void tokenize_input(const boost::json::value &v, std::string_view key,
+                    TermCounts &terms) {
+  if (const auto *s = v.if_string()) {
+    tokenize(*s, terms);
+    // Bare file names have no '/', but are still paths worth matching whole.
+    if (key == "path" || key == "file_path")
+      add_path_term(terms, *s);
+  } else if (const auto *o = v.if_object()) {
+    for (const auto &kv : *o)
+      tokenize_input(kv.value(), kv.key(), terms);
+  } else if (const auto *a = v.if_array()) {
+    for (const auto &e : *a)
+      tokenize_input(e, key, terms);
+  }
+}
+
+// Tool results are left out: they are mostly file contents and command
+// output, which would dwarf the conversation itself.
+TermCounts session_terms(const History &history) {
+  TermCounts terms;
+  for (const Message *m : history.messages()) {
+    for (const auto &block : m->content) {
+      if (const auto *text = std::get_if<TextBlock>(&block)) {
+        tokenize(text->text, terms);
+      } else if (const auto *use = std::get_if<ToolUseBlock>(&block)) {
+        ++terms[lowercase(use->name)];
+        for (const auto &kv : use->input)
+          tokenize_input(kv.value(), kv.key(), terms);
+      }
+    }
+  }
+  return terms;
+}
+
+std::string session_title(const History &history) {
+  for (const Message *m : history.messages()) {
+    if (m->role != Role::user)
+      continue;
+    for (const auto &block : m->content) {
+      const auto *text = std::get_if<TextBlock>(&block);
+      if (!text)
+        continue;
+      std::string title;
+      for (char c : text->text) {
+        if (title.size() >= 80)
+          break;
+        if (is_space(c)) {
+          if (!title.empty() && title.back() != ' ')
+            title += ' ';
+        } else {
+          title += c;
+        }
+      }
+      // Don't leave a truncated UTF-8 sequence behind.
+      if (title.size() >= 80) {
+        while (!title.empty() && (title.back() & 0xC0) == 0x80)
+          title.pop_back();
+        if (!title.empty() && (title.back() & 0xC0) == 0xC0)
+          title.pop_back();
+      }
+      return title;
+    }
+  }
+  return {};
+}
+
+bool parse_uint(std::string_view s, std::uint64_t &out) {
+  if (s.empty())
+    return false;
+  out = 0;
+  for (char c : s) {
+    if (c < '0' || c > '9')
+      return false;
+    out = out * 10 + static_cast<std::uint64_t>(c - '0');
+  }
+  return true;
+}
+
+// Record format: a "D\t<saved_at>\t<messages>\t<path>\t<title>" header,
+// one "<term>\t<tf>" line per term, then a blank line.
+template <typename Terms>
+void append_record(std::string &out, std::int64_t saved_at,
+                   std::size_t messages, std::string_view path,
+                   std::string_view title, const Terms &terms) {
+  out += "D\t";
+  out += std::to_string(saved_at);
+  out += '\t';
+  out += std::to_string(messages);
+  out += '\t';
+  out.append(path);
+  out += '\t';
+  out.append(title);
+  out += '\n';
+  for (const auto &[term, tf] : terms) {
+    out.append(term);
+    out += '\t';
+    out += std::to_string(tf);
+    out += '\n';
+  }
+  out += '\n';
+}
+
+std::vector<std::string_view> split_tabs(std::string_view line) {
+  std::vector<std::string_view> fields;
+  std::size_t start = 0;
+  while (true) {
+    std::size_t tab = line.find('\t', start);
+    if (tab == std::string_view::npos) {
+      fields.push_back(line.substr(start));
+      return fields;
+    }
+    fields.push_back(line.substr(start, tab - start));
+    start = tab + 1;
+  }
+}
+
+bool take_lock(int fd, int operation) {
+  while (::flock(fd, operation) != 0)
+    if (errno != EINTR)
+      return false;
+  return true;
+}
+
+// Whether `fd` is still the file at `path`, rather than a log that a
+// compaction has since renamed another over.
+bool is_current(int fd, const std::string &path) {
+  struct stat held{}, current{};
+  return ::fstat(fd, &held) == 0 && ::stat(path.c_str(), &current) == 0 &&
+         held.st_dev == current.st_dev && held.st_ino == current.st_ino;
+}
+
+// Opens the log at `path` and takes `operation` (LOCK_SH or LOCK_EX) on it.
+// A lock that turns out to be on a replaced log is dropped and the new one
+// opened instead.
+int open_locked(const std::string &path, int flags, int operation) {
+  while (true) {
+    int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+    if (fd < 0)
+      return -1;
+    if (!take_lock(fd, operation)) {
+      ::close(fd);
+      return -1;
+    }
+    if (is_current(fd, path))
+      return fd;
+    ::close(fd);
+  }
+}
+
+std::string read_from(int fd, std::size_t offset) {
+  std::string data;
+  char buf[65536];
+  while (true) {
+    ssize_t n = ::pread(fd, buf, sizeof buf, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return data;
+    data.append(buf, static_cast<std::size_t>(n));
+    offset += static_cast<std::size_t>(n);
+  }
+}
+
+} // namespace
+
+void SessionIndex::insert(
+    Doc doc, const std::vector<std::pair<std::string, std::uint32_t>> &terms) {
+  auto id = static_cast<std::uint32_t>(docs_.size());
+  auto [it, inserted] = doc_by_path_.try_emplace(doc.path, id);
+  if (!inserted) {
+    Doc &old = docs_[it->second];
+    old.live = false;
+    --live_;
+    total_length_ -= old.length;
+    it->second = id;
+  }
+  for (const auto &[term, tf] : terms)
+    postings_[term].push_back({id, tf});
+  ++live_;
+  total_length_ += doc.length;
+  docs_.push_back(std::move(doc));
+}
+
+std::size_t SessionIndex::parse(std::string_view data) {
+  std::size_t parsed = 0;
+  std::optional<Doc> doc;
+  std::vector<std::pair<std::string, std::uint32_t>> terms;
+  std::size_t pos = 0;
+  while (pos < data.size()) {
+    std::size_t end = data.find('\n', pos);
+    if (end == std::string::npos)
+      break; // torn final record from an interrupted append
+    std::string_view line(data.data() + pos, end - pos);
+    pos = end + 1;
+
+    if (line.empty()) {
+      if (doc)
+        insert(std::move(*doc), terms);
+      doc.reset();
+      terms.clear();
+      parsed = pos;
+    } else if (line.starts_with("D\t")) {
+      auto f = split_tabs(line);
+      std::uint64_t saved_at = 0, messages = 0;
+      doc.reset();
+      terms.clear();
+      if (f.size() == 5 && parse_uint(f[1], saved_at) &&
+          parse_uint(f[2], messages))
+        doc = Doc{std::string(f[3]), std::string(f[4]), messages,
+                  static_cast<std::int64_t>(saved_at)};
+    } else if (doc) {
+      auto tab = line.rfind('\t');
+      std::uint64_t tf = 0;
+      if (tab != std::string_view::npos &&
+          parse_uint(line.substr(tab + 1), tf)) {
+        terms.emplace_back(line.substr(0, tab),
+                           static_cast<std::uint32_t>(tf));
+        doc->length += static_cast<std::uint32_t>(tf);
+      }
+    }
+  }
+  return parsed;
+}
+
+void SessionIndex::load() {
+  loaded_ = true;
+  int fd = open_locked(path_, O_RDONLY, LOCK_SH);
+  if (fd < 0)
+    return;
+  std::size_t parsed = parse(read_from(fd, 0));
+  std::size_t dead = docs_.size() - live_;
+  if (dead >= 64 && dead > live_)
+    compact(fd, parsed);
+  ::close(fd);
+}
+
+void SessionIndex::compact(int fd, std::size_t parsed) {
+  // flock() gives up the shared lock before taking the exclusive one, so
+  // another session may have appended in between, or compacted the log
+  // itself. Appends are read in so the rewrite keeps them.
+  if (!take_lock(fd, LOCK_EX) || !is_current(fd, path_))
+    return;
+  parse(read_from(fd, parsed));
+
+  std::vector<std::uint32_t> remap(docs_.size(), UINT32_MAX);
+  std::vector<Doc> docs;
+  docs.reserve(live_);
+  for (std::uint32_t i = 0; i < docs_.size(); ++i) {
+    if (!docs_[i].live)
+      continue;
+    remap[i] = static_cast<std::uint32_t>(docs.size());
+    doc_by_path_[docs_[i].path] = remap[i];
+    docs.push_back(std::move(docs_[i]));
+  }
+  docs_ = std::move(docs);
+
+  std::vector<std::vector<std::pair<std::string_view, std::uint32_t>>> by_doc(
+      docs_.size());
+  for (auto it = postings_.begin(); it != postings_.end();) {
+    auto &list = it->second;
+    std::erase_if(list,
+                  [&](const Posting &p) { return remap[p.doc] == UINT32_MAX; });
+    for (auto &p : list) {
+      p.doc = remap[p.doc];
+      by_doc[p.doc].emplace_back(it->first, p.tf);
+    }
+    it = list.empty() ? postings_.erase(it) : std::next(it);
+  }
+
+  std::string tmp = path_ + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return;
+    std::string record;
+    for (std::size_t i = 0; i < docs_.size(); ++i) {
+      const Doc &d = docs_[i];
+      record.clear();
+      append_record(record, d.saved_at, d.messages, d.path, d.title,
+                    by_doc[i]);
+      out << record;
+    }
+    if (!out)
+      return;
+  }
+  // Still under the lock, so no append can land in the log being replaced.
+  std::error_code ec;
+  std::filesystem::rename(tmp, path_, ec);
+}
+
+bool SessionIndex::add(const std::string &session_path,
+                       const History &history) {
+  std::error_code ec;
+  std::string path = std::filesystem::absolute(session_path, ec).string();
+  if (ec || path.find_first_of("\t\n") != std::string::npos)
+    return false;
+
+  TermCounts counts = session_terms(history);
+  Doc doc{path, session_title(history), history.size(),
+          std::chrono::duration_cast<std::chrono::seconds>(
+              std::chrono::system_clock::now().time_since_epoch())
+              .count()};
+
+  std::string record;
+  append_record(record, doc.saved_at, doc.messages, doc.path, doc.title,
+                counts);
+  std::vector<std::pair<std::string, std::uint32_t>> terms;
+  terms.reserve(counts.size());
+  for (auto &[term, tf] : counts) {
+    doc.length += tf;
+    terms.emplace_back(term, tf);
+  }
+
+  std::filesystem::create_directories(
+      std::filesystem::path(path_).parent_path(), ec);
+  // Each record is one O_APPEND write under the log's lock, so concurrent
+  // sessions neither interleave their records nor append to a log that a
+  // compaction is about to replace.
+  int fd = open_locked(path_, O_WRONLY | O_CREAT | O_APPEND, LOCK_EX);
+  if (fd < 0)
+    return false;
+  ssize_t written = ::write(fd, record.data(), record.size());
+  ::close(fd);
+  if (written != static_cast<ssize_t>(record.size()))
+    return false;
+  if (loaded_)
+    insert(std::move(doc), terms);
+  return true;
+}
+
+std::size_t SessionIndex::size() {
+  if (!loaded_)
+    load();
+  return live_;
+}
+
+std::size_t SessionIndex::memory_bytes() const {
+  std::size_t bytes = docs_.capacity() * sizeof(Doc);
+  for (const auto &doc : docs_)
+    bytes += doc.path.capacity() + doc.title.capacity();
+  // Hash nodes cost about a key, a value and two pointers each.
+  bytes += doc_by_path_.size() * (sizeof(std::string) + 2 * sizeof(void *));
+  for (const auto &[term, postings] : postings_)
+    bytes += sizeof(std::string) + term.capacity() +
+             sizeof(std::vector<Posting>) + 2 * sizeof(void *) +
+             postings.capacity() * sizeof(Posting);
+  return bytes;
+}
+
+void SessionIndex::unload() {
+  loaded_ = false;
+  std::vector<Doc>().swap(docs_);
+  std::unordered_map<std::string, std::uint32_t>().swap(doc_by_path_);
+  std::unordered_map<std::string, std::vector<Posting>>().swap(postings_);
+  live_ = 0;
+  total_length_ = 0;
+}
+
+std::vector<SearchHit> SessionIndex::search(std::string_view query,
+                                            std::size_t limit) {
+  if (!loaded_)
+    load();
+  std::vector<SearchHit> hits;
+  if (live_ == 0)
+    return hits;
+
+  TermCounts query_terms;
+  tokenize(query, query_terms);
+
+  // BM25 with the usual k1/b defaults.
+  constexpr double k1 = 1.2;
+  constexpr double b = 0.75;
+  double avgdl = static_cast<double>(total_length_) / live_;
+  if (avgdl <= 0)
+    avgdl = 1;
+  std::unordered_map<std::uint32_t, double> scores;
+  for (const auto &[term, _] : query_terms) {
+    auto it = postings_.find(term);
+    if (it == postings_.end())
+      continue;
+    std::size_t df = 0;
+    for (const Posting &p : it->second)
+      df += docs_[p.doc].live;
+    if (df == 0)
+      continue;
+    double idf = std::log(1.0 + (live_ - df + 0.5) / (df + 0.5));
+    for (const Posting &p : it->second) {
+      const Doc &d = docs_[p.doc];
+      if (!d.live)
+        continue;
+      double tf = p.tf;
+      scores[p.doc] +=
+          idf * tf * (k1 + 1) / (tf + k1 * (1 - b + b * d.length / avgdl));
+    }
+  }
+
+  std::vector<std::pair<double, std::uint32_t>> ranked;
+  ranked.reserve(scores.size());
+  for (const auto &[doc, score] : scores)
+    ranked.emplace_back(score, doc);
+  std::size_t n = std::min(limit, ranked.size());
+  std::partial_sort(ranked.begin(), ranked.begin() + n, ranked.end(),
+                    [&](const auto &x, const auto &y) {
+                      if (x.first != y.first)
+                        return x.first > y.first;
+                      return docs_[x.second].saved_at >
+                             docs_[y.second].saved_at;
+                    });
+  for (std::size_t i = 0; i < n; ++i) {
+    const Doc &d = docs_[ranked[i].second];
+    hits.push_back({d.path, d.title, d.messages, d.saved_at, ranked[i].first});
+  }
+  return hits;
+}
+
+} // namespace agent
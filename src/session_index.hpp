@@ -0,0 +1,82 @@
+#pragma once
+
+#include "history.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace agent {
+
+struct SearchHit {
+  std::string path;
+  // First user prompt of the session
+  std::string title;
+  std::size_t messages = 0;
+  std::int64_t saved_at = 0;
+  double score = 0;
+};
+
+// Full-text index over saved sessions: message text, tool names, tool inputs
+// and the file paths they touch. On disk it is an append-only log of
+// per-session term lists, so indexing a save is a single appended write; a
+// re-saved path supersedes its older record, and the log is compacted on
+// load once superseded records dominate. Postings exist only in memory: the
+// first search in a process reads the whole log and inverts it, so that
+// search costs time in proportion to every session ever indexed, and later
+// ones rank with BM25 against the loaded postings. Appends and compaction
+// hold an flock() on the log so that concurrent sessions lose no records.
+class SessionIndex {
+public:
+  explicit SessionIndex(std::string path) : path_(std::move(path)) {}
+
+  const std::string &path() const { return path_; }
+
+  // Indexes (or re-indexes) the session saved at `session_path`.
+  bool add(const std::string &session_path, const History &history);
+
+  std::vector<SearchHit> search(std::string_view query,
+                                std::size_t limit = 10);
+
+  // Number of live sessions in the index.
+  std::size_t size();
+
+  // Approximate heap bytes held by the loaded index.
+  std::size_t memory_bytes() const;
+  // Frees the in-memory index; the next search reloads it from disk.
+  void unload();
+
+private:
+  struct Doc {
+    std::string path;
+    std::string title;
+    std::size_t messages = 0;
+    std::int64_t saved_at = 0;
+    std::uint32_t length = 0;
+    bool live = true;
+  };
+  struct Posting {
+    std::uint32_t doc;
+    std::uint32_t tf;
+  };
+
+  void load();
+  // Inserts the complete records in `data`; returns the bytes they span.
+  std::size_t parse(std::string_view data);
+  void insert(Doc doc,
+              const std::vector<std::pair<std::string, std::uint32_t>> &terms);
+  // Rewrites the log at `fd`, of which `parsed` bytes are loaded, without
+  // superseded records.
+  void compact(int fd, std::size_t parsed);
+
+  std::string path_;
+  bool loaded_ = false;
+  std::vector<Doc> docs_;
+  std::unordered_map<std::string, std::uint32_t> doc_by_path_;
+  std::unordered_map<std::string, std::vector<Posting>> postings_;
+  std::size_t live_ = 0;
+  std::uint64_t total_length_ = 0;
+};
+
+} // namespace agent
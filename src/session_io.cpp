@@ -0,0 +1,256 @@
+#include "session_io.hpp"
+
+#include <boost/json/basic_parser_impl.hpp>
+#include <vector>
+
+namespace agent {
+
+namespace {
+
+// SAX handler for `{"model": ..., "messages": [...]}` or a bare legacy
+// array of messages. Everything outside the messages array is skipped
+// without building values; each array element is assembled on a
+// value_stack, converted to a Message and discarded.
+class SessionHandler {
+public:
+  static constexpr std::size_t max_object_size = std::size_t(-1);
+  static constexpr std::size_t max_array_size = std::size_t(-1);
+  static constexpr std::size_t max_key_size = std::size_t(-1);
+  static constexpr std::size_t max_string_size = std::size_t(-1);
+
+  SessionHandler(LoadedSession &session, Interner &interner,
+                 const boost::json::storage_ptr &sp)
+      : session_(session), interner_(interner), sp_(sp),
+        scratch_(64 * 1024) {}
+
+  const std::string &error() const { return error_; }
+
+  bool on_document_begin(boost::system::error_code &) { return true; }
+  bool on_document_end(boost::system::error_code &) { return true; }
+
+  bool on_object_begin(boost::system::error_code &) {
+    begin_value();
+    ++depth_;
+    return true;
+  }
+
+  bool on_object_end(std::size_t n, boost::system::error_code &ec) {
+    --depth_;
+    if (capturing_) {
+      stack_.push_object(n);
+      return end_value(ec);
+    }
+    return true;
+  }
+
+  bool on_array_begin(boost::system::error_code &) {
+    begin_value();
+    if (!capturing_ && !in_messages_ &&
+        (depth_ == 0 || (depth_ == 1 && key_ == "messages"))) {
+      session_.legacy = depth_ == 0;
+      in_messages_ = true;
+      messages_depth_ = depth_ + 1;
+    }
+    ++depth_;
+    return true;
+  }
+
+  bool on_array_end(std::size_t n, boost::system::error_code &ec) {
+    --depth_;
+    if (capturing_) {
+      stack_.push_array(n);
+      return end_value(ec);
+    }
+    if (in_messages_ && depth_ + 1 == messages_depth_)
+      in_messages_ = false;
+    return true;
+  }
+
+  bool on_key_part(boost::json::string_view s, std::size_t,
+                   boost::system::error_code &) {
+    if (capturing_)
+      stack_.push_chars(s);
+    else if (depth_ == 1)
+      key_buf_.append(s.data(), s.size());
+    return true;
+  }
+
+  bool on_key(boost::json::string_view s, std::size_t,
+              boost::system::error_code &) {
+    if (capturing_) {
+      stack_.push_key(s);
+    } else if (depth_ == 1) {
+      key_buf_.append(s.data(), s.size());
+      key_.swap(key_buf_);
+      key_buf_.clear();
+    }
+    return true;
+  }
+
+  bool on_string_part(boost::json::string_view s, std::size_t,
+                      boost::system::error_code &) {
+    begin_value();
+    if (capturing_)
+      stack_.push_chars(s);
+    else if (is_model())
+      model_.append(s.data(), s.size());
+    return true;
+  }
+
+  bool on_string(boost::json::string_view s, std::size_t,
+                 boost::system::error_code &ec) {
+    begin_value();
+    if (capturing_) {
+      stack_.push_string(s);
+      return end_value(ec);
+    }
+    if (is_model()) {
+      model_.append(s.data(), s.size());
+      session_.model = std::move(model_);
+      model_.clear();
+    }
+    return true;
+  }
+
+  bool on_number_part(boost::json::string_view, boost::system::error_code &) {
+    begin_value();
+    return true;
+  }
+
+  bool on_int64(std::int64_t v, boost::json::string_view,
+                boost::system::error_code &ec) {
+    begin_value();
+    if (!capturing_)
+      return true;
+    stack_.push_int64(v);
+    return end_value(ec);
+  }
+
+  bool on_uint64(std::uint64_t v, boost::json::string_view,
+                 boost::system::error_code &ec) {
+    begin_value();
+    if (!capturing_)
+      return true;
+    stack_.push_uint64(v);
+    return end_value(ec);
+  }
+
+  bool on_double(double v, boost::json::string_view,
+                 boost::system::error_code &ec) {
+    begin_value();
+    if (!capturing_)
+      return true;
+    stack_.push_double(v);
+    return end_value(ec);
+  }
+
+  bool on_bool(bool v, boost::system::error_code &ec) {
+    begin_value();
+    if (!capturing_)
+      return true;
+    stack_.push_bool(v);
+    return end_value(ec);
+  }
+
+  bool on_null(boost::system::error_code &ec) {
+    begin_value();
+    if (!capturing_)
+      return true;
+    stack_.push_null();
+    return end_value(ec);
+  }
+
+  bool on_comment_part(boost::json::string_view, boost::system::error_code &) {
+    return true;
+  }
+  bool on_comment(boost::json::string_view, boost::system::error_code &) {
+    return true;
+  }
+
+private:
+  bool is_model() const { return depth_ == 1 && key_ == "model"; }
+
+  // Starts capturing when a value begins directly inside the messages array.
+  void begin_value() {
+    if (in_messages_ && !capturing_ && depth_ == messages_depth_) {
+      stack_.reset(boost::json::storage_ptr(&scratch_));
+      capturing_ = true;
+    }
+  }
+
+  // Finishes the captured message once its outermost value is complete.
+  bool end_value(boost::system::error_code &ec) {
+    if (depth_ != messages_depth_)
+      return true;
+    capturing_ = false;
+    {
+      boost::json::value v = stack_.release();
+      auto message = message_from_json(v, interner_, sp_);
+      if (!message) {
+        error_ = "message " + std::to_string(session_.history.size() + 1) +
+                 ": " + message.error();
+        ec = boost::system::errc::make_error_code(
+            boost::system::errc::invalid_argument);
+        return false;
+      }
+      session_.history.push_back(std::move(*message));
+    }
+    scratch_.release();
+    return true;
+  }
+
+  LoadedSession &session_;
+  Interner &interner_;
+  boost::json::storage_ptr sp_;
+  boost::json::monotonic_resource scratch_;
+  boost::json::value_stack stack_;
+
+  std::size_t depth_ = 0;
+  bool in_messages_ = false;
+  std::size_t messages_depth_ = 0;
+  bool capturing_ = false;
+  std::string key_;
+  std::string key_buf_;
+  std::string model_;
+  std::string error_;
+};
+
+} // namespace
+
+std::expected<LoadedSession, std::string>
+load_session(std::istream &in, std::uint64_t size, Interner &interner,
+             const boost::json::storage_ptr &sp, const LoadProgress &progress) {
+  LoadedSession session;
+  boost::json::basic_parser<SessionHandler> parser(boost::json::parse_options{},
+                                                   session, interner, sp);
+
+  std::vector<char> buf(1024 * 1024);
+  std::uint64_t consumed = 0;
+  std::uint64_t next_report = 0;
+  boost::system::error_code ec;
+  while (!parser.done()) {
+    in.read(buf.data(), static_cast<std::streamsize>(buf.size()));
+    auto n = static_cast<std::size_t>(in.gcount());
+    bool more = n == buf.size();
+    parser.write_some(more, buf.data(), n, ec);
+    if (ec) {
+      if (!parser.handler().error().empty())
+        return std::unexpected(parser.handler().error());
+      return std::unexpected(ec.message());
+    }
+    consumed += n;
+    if (progress && consumed >= next_report) {
+      progress(consumed, size);
+      next_report = consumed + 16 * 1024 * 1024;
+    }
+    if (!more)
+      break;
+  }
+  if (!parser.done())
+    return std::unexpected("unexpected end of file");
+  if (!session.legacy && session.history.empty() && !session.model)
+    return std::unexpected("no model or messages found");
+  return session;
+}
+
+} // namespace agent
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "history.hpp"
+#include "message.hpp"
+#include <boost/json.hpp>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <string>
+
+namespace agent {
+
+struct LoadedSession {
+  std::optional<std::string> model;
+  // True for the old raw-array save format
+  bool legacy = false;
+  History history;
+};
+
+// Called periodically with bytes consumed so far and the total size.
+using LoadProgress = std::function<void(std::uint64_t, std::uint64_t)>;
+
+// Streams a saved session from `in` straight into typed messages. Only one
+// message is ever held as a JSON DOM (in a recycled scratch arena), so peak
+// memory stays close to the size of the resulting history regardless of the
+// file size. Tool inputs are allocated with `sp`.
+std::expected<LoadedSession, std::string>
+load_session(std::istream &in, std::uint64_t size, Interner &interner,
+             const boost::json::storage_ptr &sp,
+             const LoadProgress &progress = nullptr);
+
+} // namespace agent
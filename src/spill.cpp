@@ -0,0 +1,135 @@
+#include "spill.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace agent {
+
+namespace {
+
+constexpr std::size_t segment_size = 64 * 1024 * 1024;
+
+int open_temp_file() {
+  std::error_code ec;
+  std::string dir = std::filesystem::temp_directory_path(ec).string();
+  if (ec)
+    dir = "/tmp";
+#ifdef O_TMPFILE
+  int fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd >= 0)
+    return fd;
+#endif
+  std::string name = dir + "/nanocode-spill-XXXXXX";
+  int tmp = ::mkstemp(name.data());
+  if (tmp < 0)
+    return -1;
+  ::unlink(name.c_str());
+  ::fcntl(tmp, F_SETFD, FD_CLOEXEC);
+  return tmp;
+}
+
+} // namespace
+
+struct SpillFile::File {
+  int fd = -1;
+  off_t size = 0;
+  ~File() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+};
+
+struct SpillFile::Segment {
+  std::shared_ptr<File> file;
+  off_t offset = 0;
+  char *data = nullptr;
+  std::size_t size = 0;
+  std::size_t used = 0;
+
+  ~Segment() {
+    ::munmap(data, size);
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // Give the disk space back; the file itself only ever grows.
+    ::fallocate(file->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+                static_cast<off_t>(size));
+#endif
+  }
+};
+
+SpillFile::SpillFile() {
+  int fd = open_temp_file();
+  if (fd >= 0) {
+    file_ = std::make_shared<File>();
+    file_->fd = fd;
+  }
+}
+
+bool SpillFile::new_segment(std::size_t min_size) {
+  std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+  std::size_t size =
+      std::max(segment_size, (min_size + page - 1) / page * page);
+  off_t offset = file_->size;
+  if (::ftruncate(file_->fd, offset + static_cast<off_t>(size)) != 0)
+    return false;
+  void *data =
+      ::mmap(nullptr, size, PROT_READ, MAP_SHARED, file_->fd, offset);
+  if (data == MAP_FAILED)
+    return false;
+  file_->size = offset + static_cast<off_t>(size);
+
+  current_ = std::make_shared<Segment>();
+  current_->file = file_;
+  current_->offset = offset;
+  current_->data = static_cast<char *>(data);
+  current_->size = size;
+  std::erase_if(segments_, [](const auto &s) { return s.expired(); });
+  segments_.push_back(current_);
+  return true;
+}
+
+std::pair<std::shared_ptr<const void>, std::string_view>
+SpillFile::store(std::string_view text) {
+  if (!file_ || text.empty())
+    return {};
+  if ((!current_ || current_->used + text.size() > current_->size) &&
+      !new_segment(text.size()))
+    return {};
+
+  // Written with pwrite rather than through the mapping, so the mapping only
+  // ever holds clean page-cache pages that drop_pages() can discard.
+  std::size_t done = 0;
+  while (done < text.size()) {
+    ssize_t n = ::pwrite(file_->fd, text.data() + done, text.size() - done,
+                         current_->offset +
+                             static_cast<off_t>(current_->used + done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return {};
+    done += static_cast<std::size_t>(n);
+  }
+  std::string_view stored(current_->data + current_->used, text.size());
+  current_->used += text.size();
+  return {current_, stored};
+}
+
+void SpillFile::drop_pages() {
+  for (const auto &weak : segments_)
+    if (auto segment = weak.lock())
+      ::madvise(segment->data, segment->size, MADV_DONTNEED);
+}
+
+std::uint64_t SpillFile::bytes() const {
+  std::uint64_t total = 0;
+  for (const auto &weak : segments_)
+    if (auto segment = weak.lock())
+      total += segment->used;
+  return total;
+}
+
+} // namespace agent
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace agent {
+
+// Append-only store for cold tool output, backed by an unlinked temporary
+// file that is mapped read-only in fixed-size segments. Spilled text is read
+// back through the mapping, so it costs page cache instead of heap, and
+// drop_pages() hands those pages back after each use. A segment is unmapped
+// (and its file range released) once nothing references it.
+class SpillFile {
+public:
+  SpillFile();
+  SpillFile(const SpillFile &) = delete;
+  SpillFile &operator=(const SpillFile &) = delete;
+
+  // Copies `text` into the file. The returned view stays valid while the
+  // returned owner is alive; both are empty if the file is unusable.
+  std::pair<std::shared_ptr<const void>, std::string_view>
+  store(std::string_view text);
+
+  // Drops spilled pages from this process's resident set. They stay in the
+  // page cache and fault back in on the next read.
+  void drop_pages();
+
+  // Bytes held by segments that are still referenced.
+  std::uint64_t bytes() const;
+
+private:
+  struct File;
+  struct Segment;
+
+  bool new_segment(std::size_t min_size);
+
+  std::shared_ptr<File> file_;
+  std::shared_ptr<Segment> current_;
+  std::vector<std::weak_ptr<Segment>> segments_;
+};
+
+} // namespace agent
@@ -1,12 +1,26 @@
 #include "tools.hpp"
+#include "atomic_write.hpp"
+#include "batch_read.hpp"
+#include "file_cache.hpp"
+#include "file_view.hpp"
+#include "output.hpp"
+#include "patch.hpp"
+#include <algorithm>
+#include <cerrno>
 #include <filesystem>
 #include <format>
 #include <fstream>
-#include <iostream>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <optional>
+#include <poll.h>
 #include <ranges>
 #include <regex>
 #include <sstream>
 #include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -22,6 +36,17 @@ std::string get_string(const boost::json::object &args,
   return default_val;
 }
 
+// Borrowed view of a string argument; avoids copying large inputs such as
+// `write` contents.
+std::string_view get_string_view(const boost::json::object &args,
+                                 boost::json::string_view key) {
+  if (auto it = args.find(key); it != args.end() && it->value().is_string()) {
+    const auto &str = it->value().get_string();
+    return {str.data(), str.size()};
+  }
+  return {};
+}
+
 long long get_int(const boost::json::object &args, boost::json::string_view key,
                   long long default_val = 0) {
   if (auto it = args.find(key); it != args.end() && it->value().is_number()) {
@@ -38,101 +63,721 @@ bool get_bool(const boost::json::object &args, boost::json::string_view key,
   return default_val;
 }
 
+// Longer lines (minified code, data blobs) are cut in read output.
+constexpr std::size_t max_read_line_bytes = 2000;
+
+struct LineRange {
+  long long first = 0;
+  long long count = 0;
+};
+
+// Clamps a requested range to a file of `lines` lines. A negative offset
+// counts from the end; a negative limit reads to the end.
+LineRange clamp_range(long long lines, long long offset, long long limit) {
+  if (offset < 0)
+    offset = std::max(0LL, lines + offset);
+  if (offset >= lines)
+    return {lines, 0};
+  if (limit < 0 || limit > lines - offset)
+    limit = lines - offset;
+  return {offset, limit};
+}
+
+// Appends `count` lines of `view` starting at `first` to `out`, numbered as
+// read shows them. Stops before a line would take `out` past `budget` bytes
+// and returns the number of lines appended.
+long long append_lines(const FileView &view, long long first, long long count,
+                       std::string &out,
+                       std::size_t budget = static_cast<std::size_t>(-1)) {
+  std::string_view text = view.text();
+  std::size_t pos = view.line_start(first);
+  for (long long idx = first; idx < first + count; ++idx) {
+    std::size_t end = std::min(text.find('\n', pos), text.size());
+    std::string_view line = text.substr(pos, end - pos);
+    pos = end + 1;
+    std::size_t before = out.size();
+    if (line.size() <= max_read_line_bytes) {
+      std::format_to(std::back_inserter(out), "{:4}| {}\n", idx + 1, line);
+    } else {
+      std::format_to(std::back_inserter(out), "{:4}| {} ... [{} more bytes]\n",
+                     idx + 1, line.substr(0, max_read_line_bytes),
+                     line.size() - max_read_line_bytes);
+    }
+    if (out.size() > budget) {
+      out.resize(before);
+      return idx - first;
+    }
+  }
+  return count;
+}
+
+// Only the head of a file holds its includes and imports.
+constexpr std::size_t prefetch_scan_bytes = 64 * 1024;
+
 ToolResult execute_read(const boost::json::object &args) {
   std::string path = get_string(args, "path");
+  // A negative offset counts from the end of the file.
   long long offset = get_int(args, "offset", 0);
   // Use negative number to represent all lines by default
   long long limit = get_int(args, "limit", -1);
 
-  std::ifstream file(path);
-  if (!file.is_open())
+  auto view = open_file_view(path);
+  if (!view)
     return std::unexpected("error: could not open " + path);
+  std::string_view text = view->text();
+  // Warm the includes, imports and tests the model tends to ask for next.
+  file_cache().prefetch(
+      prefetch_candidates(path, text.substr(0, prefetch_scan_bytes)));
+
+  auto [first, count] =
+      clamp_range(static_cast<long long>(view->lines()), offset, limit);
+  std::string out;
+  append_lines(*view, first, count, out);
+  return out;
+}
 
-  std::vector<std::string> lines;
-  std::string line;
-  while (std::getline(file, line)) {
-    lines.push_back(line);
+// Budget for one read_many result when the call does not set one.
+constexpr std::size_t read_many_default_bytes = 100 * 1024;
+constexpr std::size_t read_many_max_files = 32;
+// Larger files are opened through open_file_view(), which maps them and
+// keeps their line index, instead of being read whole.
+constexpr std::size_t read_many_max_read_bytes = 1024 * 1024;
+ToolResult execute_read_many(const boost::json::object &args) {
+  struct Request {
+    std::string path;
+    long long offset = 0;
+    long long limit = -1;
+  };
+  std::vector<Request> requests;
+  if (auto it = args.find("files");
+      it != args.end() && it->value().is_array()) {
+    for (const auto &file : it->value().get_array()) {
+      if (file.is_string()) {
+        requests.push_back({std::string(file.get_string())});
+      } else if (file.is_object()) {
+        const auto &obj = file.get_object();
+        requests.push_back({get_string(obj, "path"), get_int(obj, "offset", 0),
+                            get_int(obj, "limit", -1)});
+      }
+    }
   }
+  if (requests.empty())
+    return std::unexpected("error: files must list at least one path");
+  if (requests.size() > read_many_max_files)
+    return std::unexpected("error: at most " +
+                           std::to_string(read_many_max_files) +
+                           " files per call");
+  long long max_bytes = get_int(args, "max_bytes", read_many_default_bytes);
+  auto budget = static_cast<std::size_t>(std::max(1024LL, max_bytes));
 
-  if (limit < 0)
-    limit = lines.size() - offset;
+  std::vector<std::string> paths;
+  for (const auto &request : requests)
+    paths.push_back(request.path);
 
-  // Bounds checking
-  if (offset < 0)
-    offset = 0;
-  if (offset >= (long long)lines.size())
-    return "";
+  std::string out;
+  std::size_t shown = 0;
+  auto show = [&](std::size_t i, const FileData &data) {
+    const Request &request = requests[i];
+    if (!out.empty())
+      out += '\n';
+    if (data.error) {
+      std::format_to(std::back_inserter(out),
+                     "==> {} <==\nerror: could not open {}\n", request.path,
+                     request.path);
+      ++shown;
+      return out.size() < budget;
+    }
+    // Files cut at the read cap are mapped whole instead; a buffer that was
+    // read is only borrowed for the length of this callback.
+    std::shared_ptr<const FileView> mapped;
+    if (data.content.size() < data.size)
+      mapped = open_file_view(request.path);
+    std::optional<FileView> borrowed;
+    if (!mapped)
+      borrowed.emplace(nullptr, data.content);
+    const FileView &view = mapped ? *mapped : *borrowed;
+    bool cut = !mapped && data.content.size() < data.size;
+    auto lines = static_cast<long long>(view.lines());
+    auto [first, count] = clamp_range(lines, request.offset, request.limit);
+    std::format_to(std::back_inserter(out),
+                   "==> {} (lines {}-{} of {}{}) <==\n", request.path,
+                   count ? first + 1 : first, first + count,
+                   cut ? "at least " : "", lines);
+    long long appended = append_lines(view, first, count, out, budget);
+    ++shown;
+    if (appended == count)
+      return true;
+    std::format_to(std::back_inserter(out),
+                   "[budget reached; {} more lines, continue with offset={}]\n",
+                   count - appended, first + appended);
+    return false;
+  };
+  read_files(paths, show, read_many_max_read_bytes);
 
-  std::stringstream ss;
-  auto sliced = std::views::all(lines) | std::views::drop(offset) |
-                std::views::take(limit);
-  long long idx = offset + 1;
-  for (const auto &l : sliced) {
-    ss << std::format("{:4}| {}\n", idx++, l);
+  if (shown < requests.size()) {
+    std::format_to(std::back_inserter(out), "\n[not read within budget:");
+    for (std::size_t i = shown; i < requests.size(); ++i)
+      std::format_to(std::back_inserter(out), " {}", requests[i].path);
+    out += "]\n";
   }
-  return ss.str();
+  return out;
 }
 
 ToolResult execute_write(const boost::json::object &args) {
   std::string path = get_string(args, "path");
-  std::string content = get_string(args, "content");
+  std::string_view content = get_string_view(args, "content");
 
-  std::ofstream file(path);
-  if (!file.is_open())
-    return std::unexpected("error: could not open " + path + " for writing");
-
-  file << content;
+  // Temp file and rename: an interrupted write leaves the old file intact.
+  auto written = replace_file(path, content);
+  file_cache().invalidate(path);
+  if (!written)
+    return std::unexpected("error: " + written.error());
   return "ok";
 }
 
+constexpr std::size_t write_many_max_files = 256;
+ToolResult execute_write_many(const boost::json::object &args) {
+  std::vector<FileWrite> writes;
+  if (auto it = args.find("files");
+      it != args.end() && it->value().is_array()) {
+    for (const auto &file : it->value().get_array()) {
+      if (!file.is_object())
+        continue;
+      // Missing content stays disengaged rather than becoming an empty
+      // file; replace_files() leaves such entries alone.
+      const auto &obj = file.get_object();
+      std::optional<std::string_view> content;
+      if (const auto *s = obj.if_contains("content"); s && s->is_string())
+        content = s->get_string();
+      writes.push_back({get_string(obj, "path"), content});
+    }
+  }
+  if (writes.empty())
+    return std::unexpected("error: files must list at least one path");
+  if (writes.size() > write_many_max_files)
+    return std::unexpected("error: at most " +
+                           std::to_string(write_many_max_files) +
+                           " files per call");
+  for (std::size_t i = 0; i < writes.size(); ++i) {
+    for (std::size_t j = 0; j < i; ++j)
+      if (writes[j].path == writes[i].path)
+        return std::unexpected("error: " + writes[i].path +
+                               " is listed twice");
+    if (writes[i].path.empty())
+      return std::unexpected(std::format("error: file {} has no path", i));
+  }
+
+  WriteOptions options;
+  options.sync = get_bool(args, "sync", false);
+  options.create_dirs = get_bool(args, "create_dirs", true);
+  auto results = replace_files(writes, options);
+
+  std::string out;
+  std::size_t written = 0;
+  for (std::size_t i = 0; i < writes.size(); ++i) {
+    file_cache().invalidate(writes[i].path);
+    if (!writes[i].content) {
+      std::format_to(std::back_inserter(out),
+                     "\n{}: error: content must be a string", writes[i].path);
+    } else if (results[i]) {
+      ++written;
+      std::format_to(std::back_inserter(out), "\n{}: ok ({} bytes)",
+                     writes[i].path, writes[i].content->size());
+    } else {
+      std::format_to(std::back_inserter(out), "\n{}: error: {}",
+                     writes[i].path, results[i].error());
+    }
+  }
+  // Any failure is an error, so routing sees it, even though the files
+  // that were written stay written.
+  if (written < writes.size())
+    return std::unexpected(std::format("error: wrote {} of {} files{}",
+                                       written, writes.size(), out));
+  return std::format("wrote {} files{}", written, out);
+}
+
+struct Splice {
+  std::size_t pos = 0;
+  std::size_t len = 0;
+  std::string_view replacement;
+  // Index of the edit the splice came from, for error messages.
+  std::size_t edit = 0;
+};
+
+// Needles at least this long are searched with Boyer-Moore-Horspool.
+// string_view::find scans for the first byte and compares from there, which
+// is faster for short needles but crawls when the needle starts with
+// indentation that appears on every line, as edit snippets usually do.
+constexpr std::size_t horspool_min_needle = 16;
+
+// Offsets of the non-overlapping occurrences of `needle` in `text`.
+std::vector<std::size_t> find_all(std::string_view text,
+                                  std::string_view needle) {
+  std::vector<std::size_t> hits;
+  if (needle.size() < horspool_min_needle) {
+    for (std::size_t pos = 0;
+         (pos = text.find(needle, pos)) != std::string_view::npos;
+         pos += needle.size())
+      hits.push_back(pos);
+    return hits;
+  }
+  std::boyer_moore_horspool_searcher searcher(needle.begin(), needle.end());
+  for (auto it = text.begin();;) {
+    auto [match, end] = searcher(it, text.end());
+    if (match == text.end())
+      break;
+    hits.push_back(static_cast<std::size_t>(match - text.begin()));
+    it = end;
+  }
+  return hits;
+}
+
+// Builds `text` with `splices` (sorted, non-overlapping) applied, in one
+// pass into a buffer sized up front.
+std::string apply_splices(std::string_view text,
+                          const std::vector<Splice> &splices) {
+  std::size_t size = text.size();
+  for (const auto &splice : splices)
+    size = size - splice.len + splice.replacement.size();
+  std::string out;
+  out.reserve(size);
+  std::size_t copied = 0;
+  for (const auto &splice : splices) {
+    out.append(text, copied, splice.pos - copied);
+    out.append(splice.replacement);
+    copied = splice.pos + splice.len;
+  }
+  out.append(text, copied);
+  return out;
+}
+
+// How an edit's old string was found in the file. Later tiers are only
+// tried when earlier ones find nothing.
+enum class MatchTier {
+  exact,
+  // Line by line, ignoring trailing whitespace and CR/LF differences.
+  trailing_whitespace,
+  // Line by line, ignoring leading and trailing whitespace; the new text is
+  // re-indented to the file's indentation.
+  indentation,
+};
+
+const char *describe(MatchTier tier) {
+  switch (tier) {
+  case MatchTier::exact:
+    return "exact";
+  case MatchTier::trailing_whitespace:
+    return "ignoring trailing whitespace and line endings";
+  case MatchTier::indentation:
+    return "ignoring indentation";
+  }
+  return "";
+}
+
+struct EditMatch {
+  MatchTier tier = MatchTier::exact;
+  std::vector<Splice> splices;
+};
+
+struct LineSpan {
+  std::size_t begin = 0;
+  // End of the line's text, before its '\n'.
+  std::size_t end = 0;
+};
+
+std::vector<LineSpan> split_lines(std::string_view text) {
+  std::vector<LineSpan> lines;
+  for (std::size_t pos = 0; pos <= text.size();) {
+    std::size_t end = std::min(text.find('\n', pos), text.size());
+    lines.push_back({pos, end});
+    pos = end + 1;
+  }
+  return lines;
+}
+
+constexpr std::string_view blanks = " \t\r";
+
+std::string_view trim_end(std::string_view s) {
+  std::size_t end = s.find_last_not_of(blanks);
+  return end == std::string_view::npos ? std::string_view{}
+                                       : s.substr(0, end + 1);
+}
+
+std::string_view trim(std::string_view s) {
+  s = trim_end(s);
+  return s.substr(std::min(s.find_first_not_of(blanks), s.size()));
+}
+
+std::string_view indent_of(std::string_view line) {
+  return line.substr(0, std::min(line.find_first_not_of(" \t"), line.size()));
+}
+
+// Appends `extra` indentation to `out`, rewritten from old's indentation
+// step to the file's: one `step_from` becomes one `step_to`, so four-space
+// levels can become tabs or two-space levels. Anything that does not divide
+// evenly is kept as written.
+void append_indent(std::string &out, std::string_view extra,
+                   std::string_view step_from, std::string_view step_to) {
+  auto uniform = [](std::string_view s) {
+    return !s.empty() &&
+           s.find_first_not_of(s.front()) == std::string_view::npos;
+  };
+  if (extra.empty() || !uniform(step_from) || !uniform(step_to) ||
+      !uniform(extra) || extra.front() != step_from.front() ||
+      extra.size() * step_to.size() % step_from.size() != 0) {
+    out.append(extra);
+    return;
+  }
+  out.append(extra.size() * step_to.size() / step_from.size(),
+             step_to.front());
+}
+
+// Whole lines of `text` that equal the lines of `old_str` after both are
+// normalized for `tier`. Each match becomes a splice whose replacement is
+// `new_str` adapted to the matched lines' indentation and line endings;
+// rewritten replacements are kept alive in `storage`.
+std::vector<Splice> match_lines(std::string_view text,
+                                const std::vector<LineSpan> &lines,
+                                std::string_view old_str,
+                                std::string_view new_str, MatchTier tier,
+                                std::list<std::string> &storage) {
+  auto normalize = [tier](std::string_view line) {
+    return tier == MatchTier::indentation ? trim(line) : trim_end(line);
+  };
+  // A trailing newline in old means the match swallows the last line's end.
+  bool whole_last_line = old_str.ends_with('\n');
+  if (whole_last_line)
+    old_str.remove_suffix(1);
+  auto old_lines = split_lines(old_str);
+  std::vector<std::string_view> wanted;
+  for (const auto &span : old_lines)
+    wanted.push_back(
+        normalize(old_str.substr(span.begin, span.end - span.begin)));
+  std::size_t anchor = 0;
+  while (anchor < wanted.size() && wanted[anchor].empty())
+    ++anchor;
+  if (anchor == wanted.size() || wanted.size() > lines.size())
+    return {};
+
+  auto line_at = [&](std::size_t i) {
+    return text.substr(lines[i].begin, lines[i].end - lines[i].begin);
+  };
+  std::vector<Splice> splices;
+  for (std::size_t i = 0; i + wanted.size() <= lines.size();) {
+    bool equal = true;
+    for (std::size_t j = 0; j < wanted.size() && equal; ++j)
+      equal = normalize(line_at(i + j)) == wanted[j];
+    if (!equal) {
+      ++i;
+      continue;
+    }
+
+    const LineSpan &last = lines[i + wanted.size() - 1];
+    bool crlf = last.end > last.begin && text[last.end - 1] == '\r';
+    std::size_t end = last.end - (crlf && !whole_last_line);
+    if (whole_last_line && end < text.size())
+      ++end;
+
+    std::string replacement;
+    if (tier == MatchTier::indentation) {
+      // Shift new's lines by the difference between old's indentation and
+      // the file's at the first non-blank line, and learn how a deeper
+      // level is written from the first matched line that has one.
+      auto old_line = [&](std::size_t j) {
+        return old_str.substr(old_lines[j].begin,
+                              old_lines[j].end - old_lines[j].begin);
+      };
+      std::string_view from = indent_of(old_line(anchor));
+      std::string_view to = indent_of(line_at(i + anchor));
+      std::string_view step_from, step_to;
+      for (std::size_t j = anchor + 1; j < wanted.size(); ++j) {
+        std::string_view old_indent = indent_of(old_line(j));
+        std::string_view file_indent = indent_of(line_at(i + j));
+        if (!wanted[j].empty() && old_indent.size() > from.size() &&
+            old_indent.starts_with(from) && file_indent.size() > to.size() &&
+            file_indent.starts_with(to)) {
+          step_from = old_indent.substr(from.size());
+          step_to = file_indent.substr(to.size());
+          break;
+        }
+      }
+      for (const auto &span : split_lines(new_str)) {
+        std::string_view line =
+            new_str.substr(span.begin, span.end - span.begin);
+        if (!trim(line).empty() && line.starts_with(from)) {
+          line.remove_prefix(from.size());
+          replacement.append(to);
+          append_indent(replacement, indent_of(line), step_from, step_to);
+          line.remove_prefix(indent_of(line).size());
+        }
+        replacement.append(line);
+        if (span.end < new_str.size())
+          replacement += '\n';
+      }
+    } else {
+      replacement = new_str;
+    }
+    if (crlf && replacement.find('\r') == std::string::npos) {
+      std::string converted;
+      converted.reserve(replacement.size() + replacement.size() / 32);
+      for (char c : replacement) {
+        if (c == '\n')
+          converted += '\r';
+        converted += c;
+      }
+      replacement = std::move(converted);
+    }
+    storage.push_back(std::move(replacement));
+    splices.push_back({lines[i].begin, end - lines[i].begin, storage.back()});
+    i += wanted.size();
+  }
+  return splices;
+}
+
+// Finds where `old_str` applies in `text`: exactly if it can, otherwise by
+// the looser line tiers in order. Fails if nothing matches, or if several
+// places match and `replace_all` is not set.
+std::expected<EditMatch, std::string>
+match_edit(std::string_view text, std::string_view old_str,
+           std::string_view new_str, bool replace_all,
+           std::list<std::string> &storage) {
+  if (old_str.empty())
+    return std::unexpected("old_string is empty");
+  EditMatch match;
+  for (std::size_t pos : find_all(text, old_str))
+    match.splices.push_back({pos, old_str.size(), new_str});
+  if (match.splices.empty()) {
+    auto lines = split_lines(text);
+    for (auto tier : {MatchTier::trailing_whitespace, MatchTier::indentation}) {
+      match.tier = tier;
+      match.splices = match_lines(text, lines, old_str, new_str, tier, storage);
+      if (!match.splices.empty())
+        break;
+    }
+  }
+  std::size_t count = match.splices.size();
+  if (count == 0)
+    return std::unexpected("old_string not found");
+  if (count > 1 && !replace_all) {
+    if (match.tier == MatchTier::exact)
+      return std::unexpected(std::format(
+          "old_string appears {} times, must be unique (use all=true)", count));
+    return std::unexpected(
+        std::format("old_string matches {} places {}, must be unique (use "
+                    "all=true)",
+                    count, describe(match.tier)));
+  }
+  return match;
+}
+
 ToolResult execute_edit(const boost::json::object &args) {
   std::string path = get_string(args, "path");
-  std::string old_str = get_string(args, "old");
-  std::string new_str = get_string(args, "new");
+  std::string_view old_str = get_string_view(args, "old");
+  std::string_view new_str = get_string_view(args, "new");
   bool replace_all = get_bool(args, "all", false);
 
-  std::ifstream in(path);
-  if (!in.is_open())
+  auto cached = file_cache().read(path);
+  if (!cached)
     return std::unexpected("error: could not open " + path);
+  std::string_view text = *cached;
+
+  // One scan finds every match; the result is then built in one pass, so
+  // all=true stays linear however many matches there are.
+  std::list<std::string> storage;
+  auto match = match_edit(text, old_str, new_str, replace_all, storage);
+  if (!match)
+    return std::unexpected("error: " + match.error());
+  std::string result = apply_splices(text, match->splices);
 
-  std::stringstream buffer;
-  buffer << in.rdbuf();
-  std::string text = buffer.str();
-  in.close();
+  auto written = replace_file(path, result);
+  file_cache().invalidate(path);
+  if (!written)
+    return std::unexpected("error: " + written.error());
 
-  size_t count = 0;
-  size_t pos = 0;
-  while ((pos = text.find(old_str, pos)) != std::string::npos) {
-    count++;
-    pos += old_str.length();
+  if (match->tier != MatchTier::exact)
+    return std::format("ok (matched {})", describe(match->tier));
+  return "ok";
+}
+
+ToolResult execute_multi_edit(const boost::json::object &args) {
+  std::string path = get_string(args, "path");
+  auto it = args.find("edits");
+  if (it == args.end() || !it->value().is_array() ||
+      it->value().get_array().empty())
+    return std::unexpected("error: edits must list at least one edit");
+  const auto &edits = it->value().get_array();
+
+  auto cached = file_cache().read(path);
+  if (!cached)
+    return std::unexpected("error: could not open " + path);
+  std::string_view text = *cached;
+
+  // Every edit is matched against the file as it is now, and all of them
+  // are checked before anything is written.
+  std::vector<Splice> splices;
+  std::list<std::string> storage;
+  std::string loose;
+  for (std::size_t i = 0; i < edits.size(); ++i) {
+    if (!edits[i].is_object())
+      return std::unexpected(std::format("error: edit {} is not an object", i));
+    const auto &edit = edits[i].get_object();
+    auto match =
+        match_edit(text, get_string_view(edit, "old"),
+                   get_string_view(edit, "new"), get_bool(edit, "all", false),
+                   storage);
+    if (!match)
+      return std::unexpected(
+          std::format("error: edit {}: {}", i, match.error()));
+    if (match->tier != MatchTier::exact)
+      std::format_to(std::back_inserter(loose), "; edit {} matched {}", i,
+                     describe(match->tier));
+    for (auto &splice : match->splices) {
+      splice.edit = i;
+      splices.push_back(splice);
+    }
+  }
+  std::ranges::sort(splices, {}, &Splice::pos);
+  for (std::size_t i = 1; i < splices.size(); ++i) {
+    const auto &prev = splices[i - 1];
+    if (splices[i].pos < prev.pos + prev.len)
+      return std::unexpected(
+          std::format("error: edits {} and {} overlap; merge them into one",
+                      prev.edit, splices[i].edit));
   }
 
-  if (count == 0)
-    return std::unexpected("error: old_string not found");
-  if (count > 1 && !replace_all)
-    return std::unexpected(std::format(
-        "error: old_string appears {} times, must be unique (use all=true)",
-        count));
-
-  if (replace_all) {
-    pos = 0;
-    while ((pos = text.find(old_str, pos)) != std::string::npos) {
-      text.replace(pos, old_str.length(), new_str);
-      pos += new_str.length();
+  std::string result = apply_splices(text, splices);
+  auto written = replace_file(path, result);
+  file_cache().invalidate(path);
+  if (!written)
+    return std::unexpected("error: " + written.error());
+  return std::format("ok ({} replacements{})", splices.size(), loose);
+}
+
+ToolResult execute_apply_patch(const boost::json::object &args) {
+  auto files = parse_patch(get_string_view(args, "patch"));
+  if (!files)
+    return std::unexpected("error: " + files.error());
+
+  // Every file is patched in memory first; nothing is written unless all
+  // of them apply. Reserved up front so the views in `writes` stay valid.
+  std::vector<std::string> contents;
+  contents.reserve(files->size());
+  std::vector<FileWrite> writes;
+  std::vector<std::string> seen;
+  std::string summary, errors;
+
+  // Files the patch deletes and then creates or renames another file onto.
+  // Only these may be overwritten by a new path; the deletion itself is
+  // left to the write that replaces them.
+  std::vector<std::string> replaced;
+  for (const auto &file : *files)
+    if (file.new_path.empty())
+      for (const auto &other : *files)
+        if (other.new_path == file.old_path && other.old_path != file.old_path)
+          replaced.push_back(file.old_path);
+  auto is_replaced = [&](const std::string &path) {
+    return std::ranges::find(replaced, path) != replaced.end();
+  };
+
+  for (const auto &file : *files) {
+    const std::string &target =
+        file.new_path.empty() ? file.old_path : file.new_path;
+    if (file.new_path.empty() && is_replaced(file.old_path))
+      continue;
+    bool repeated = false;
+    for (const auto *path : {&file.old_path, &file.new_path}) {
+      if (path->empty())
+        continue;
+      if (std::ranges::find(seen, *path) != seen.end())
+        repeated = true;
+      else
+        seen.push_back(*path);
+    }
+    if (repeated) {
+      errors += "\n" + target +
+                ": appears in more than one section; combine its hunks";
+      continue;
+    }
+
+    std::shared_ptr<const std::string> current;
+    if (!file.old_path.empty()) {
+      current = file_cache().read(file.old_path);
+      if (!current) {
+        errors += "\n" + file.old_path + ": could not open";
+        continue;
+      }
+    }
+    if (std::error_code ec; file.old_path != file.new_path &&
+                            !file.new_path.empty() &&
+                            !is_replaced(file.new_path) &&
+                            fs::exists(file.new_path, ec)) {
+      errors += "\n" + file.new_path +
+                ": already exists; delete it in the same patch to replace it";
+      continue;
+    }
+    if (file.new_path.empty()) {
+      writes.push_back({file.old_path, std::nullopt});
+      summary += "\n" + file.old_path + ": deleted";
+      continue;
+    }
+
+    std::vector<std::string> notes;
+    auto patched = apply_file_patch(current ? std::string_view(*current)
+                                            : std::string_view(),
+                                    file, notes);
+    if (!patched) {
+      errors += "\n" + target + ": " + patched.error();
+      continue;
     }
-  } else {
-    pos = text.find(old_str);
-    if (pos != std::string::npos) {
-      text.replace(pos, old_str.length(), new_str);
+    contents.push_back(std::move(*patched));
+    writes.push_back({file.new_path, contents.back()});
+    summary += std::format("\n{}: {} hunk{}", file.new_path, file.hunks.size(),
+                           file.hunks.size() == 1 ? "" : "s");
+    if (file.old_path.empty())
+      summary += ", created";
+    if (is_replaced(file.new_path))
+      summary += ", replacing the deleted file";
+    if (!file.old_path.empty() && file.old_path != file.new_path) {
+      writes.push_back({file.old_path, std::nullopt});
+      summary += ", renamed from " + file.old_path;
     }
+    for (const auto &note : notes)
+      summary += "; " + note;
   }
+  if (!errors.empty())
+    return std::unexpected("error: patch not applied, no file was changed" +
+                           errors);
 
-  std::ofstream out(path);
-  if (!out.is_open())
-    return std::unexpected("error: could not open " + path + " for writing");
-  out << text;
+  auto committed = commit_files(writes);
+  for (const auto &write : writes)
+    file_cache().invalidate(write.path);
+  if (!committed)
+    return std::unexpected("error: " + committed.error() +
+                           "; no file was changed");
+  return "ok" + summary;
+}
 
-  return "ok";
+// Stops a walk from descending into nanocode's own state directory, which
+// holds copies of workspace files.
+bool skip_state_dir(fs::recursive_directory_iterator &it) {
+  if (it->path().filename() != state_dir_name)
+    return false;
+  it.disable_recursion_pending();
+  return true;
+}
+
+void create_state_dir(const fs::path &dir) {
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec)
+    return;
+  for (fs::path p = dir; p.has_relative_path(); p = p.parent_path()) {
+    if (p.filename() != state_dir_name)
+      continue;
+    if (!fs::exists(p / ".gitignore", ec))
+      std::ofstream(p / ".gitignore") << "*\n";
+    return;
+  }
 }
 
 // Simple glob-to-regex conversion (handles * and **)
@@ -182,6 +827,8 @@ ToolResult execute_glob(const boost::json::object &args) {
       ec.clear();
       continue;
     } // ignore errors traversing
+    if (skip_state_dir(it))
+      continue;
     if (fs::is_regular_file(it->status(ec))) {
       // Check if relative path or filename matches pattern depending on how
       // nanocode handled it. nanocode joined path/pat. Let's match the relative
@@ -220,6 +867,13 @@ ToolResult execute_glob(const boost::json::object &args) {
   return ss.str();
 }
 
+// Files handed to read_files() per batch: enough to keep the I/O queue
+// full, few enough that an early match does not read far ahead.
+constexpr std::size_t grep_batch_files = 256;
+// Larger files are searched through a mapping (open_file_view) instead of
+// being read into the batch's buffers.
+constexpr std::size_t grep_max_read_bytes = 1024 * 1024;
+
 ToolResult execute_grep(const boost::json::object &args) {
   std::string pat = get_string(args, "pat");
   std::string path = get_string(args, "path", ".");
@@ -240,6 +894,31 @@ ToolResult execute_grep(const boost::json::object &args) {
   if (!fs::exists(start_path, ec))
     return "none";
 
+  // Files are read in batches with their I/O overlapped; the walk stops
+  // early once enough lines matched.
+  std::vector<std::string> batch;
+  bool full = false;
+  auto search = [&](std::size_t i, const FileData &data) {
+    std::string_view text = data.content;
+    std::shared_ptr<const FileView> view;
+    if (text.size() < data.size && (view = open_file_view(batch[i])))
+      text = view->text();
+    long long line_num = 1;
+    for (std::size_t pos = 0; pos < text.size(); ++line_num) {
+      std::size_t end = std::min(text.find('\n', pos), text.size());
+      std::string_view line = text.substr(pos, end - pos);
+      pos = end + 1;
+      if (std::regex_search(line.data(), line.data() + line.size(), re)) {
+        hits.push_back(std::format("{}:{}:{}", batch[i], line_num, line));
+        if (hits.size() >= 50) { // match Python's top 50 limit efficiently
+          full = true;
+          return false;
+        }
+      }
+    }
+    return true;
+  };
+
   for (auto it = fs::recursive_directory_iterator(
            start_path, fs::directory_options::skip_permission_denied, ec);
        it != fs::recursive_directory_iterator(); it.increment(ec)) {
@@ -247,25 +926,21 @@ ToolResult execute_grep(const boost::json::object &args) {
       ec.clear();
       continue;
     }
+    if (skip_state_dir(it))
+      continue;
     if (fs::is_regular_file(it->status(ec))) {
-      std::ifstream file(it->path());
-      if (!file.is_open())
-        continue;
-      std::string line;
-      long long line_num = 1;
-      while (std::getline(file, line)) {
-        if (std::regex_search(line, re)) {
-          hits.push_back(
-              std::format("{}:{}:{}", it->path().string(), line_num, line));
-          if (hits.size() >= 50)
-            goto done; // match Python's top 50 limit efficiently
-        }
-        line_num++;
+      batch.push_back(it->path().string());
+      if (batch.size() == grep_batch_files) {
+        read_files(batch, search, grep_max_read_bytes);
+        batch.clear();
+        if (full)
+          break;
       }
     }
   }
+  if (!full)
+    read_files(batch, search, grep_max_read_bytes);
 
-done:
   if (hits.empty())
     return "none";
 
@@ -280,37 +955,77 @@ done:
   return ss.str();
 }
 
-ToolResult execute_bash(const boost::json::object &args) {
-  std::string cmd = get_string(args, "cmd");
+struct CommandResult {
+  std::string output;
+  // Exit code, or 128 + signal number if the command was killed.
+  int status = 0;
+};
 
-  // Open popen capturing both stdout and stderr
-  std::string full_cmd = cmd + " 2>&1";
-  FILE *fp = popen(full_cmd.c_str(), "r");
+// Runs `cmd` through the shell with stderr folded into stdout, echoing its
+// output live, one `prefix`ed line at a time. Terminal output is paced by a
+// timer on the io_context, which cannot fire while this blocks the thread,
+// so whatever is queued is flushed before each read that would wait.
+std::optional<CommandResult> run_command(const std::string &cmd,
+                                         std::string_view prefix) {
+  FILE *fp = popen((cmd + " 2>&1").c_str(), "r");
   if (!fp)
-    return std::unexpected("error: popen failed");
+    return std::nullopt;
+  int fd = fileno(fp);
 
-  std::stringstream out;
-  char buffer[1024];
-  while (fgets(buffer, sizeof(buffer), fp) != nullptr) {
-    std::string line(buffer);
-    // Print live to stdout to mimic python script
-    std::cout << "  \033[2m"
-              << "│ " << line << "\033[0m" << std::flush;
-    out << line;
+  std::string out;
+  std::size_t echoed = 0;
+  char buffer[4096];
+  for (;;) {
+    pollfd pfd{fd, POLLIN, 0};
+    if (::poll(&pfd, 1, 0) == 0)
+      term::out().flush();
+    ssize_t n = ::read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    out.append(buffer, static_cast<std::size_t>(n));
+    for (std::size_t end; (end = out.find('\n', echoed)) != std::string::npos;
+         echoed = end + 1)
+      term::out().write(std::format("{}{}\033[0m\n", prefix,
+                                    std::string_view(out).substr(
+                                        echoed, end - echoed)));
   }
-  pclose(fp);
+  if (echoed < out.size())
+    term::out().write(std::format("{}{}\033[0m", prefix,
+                                  std::string_view(out).substr(echoed)));
+  int status = pclose(fp);
+  if (status != -1 && WIFSIGNALED(status))
+    return CommandResult{std::move(out), 128 + WTERMSIG(status)};
+  return CommandResult{std::move(out),
+                       status != -1 && WIFEXITED(status) ? WEXITSTATUS(status)
+                                                         : 0};
+}
 
-  std::string result = out.str();
-  if (result.empty())
-    return "(empty)";
-  // Trim trailing newline if present, but since we concatenated lines directly,
-  // a simple check works
-  while (!result.empty() && (result.back() == '\n' || result.back() == '\r')) {
+// Tool output for a finished command: trailing newlines trimmed, and a
+// failing exit status turned into an error so routing keeps the turn on
+// the main model.
+ToolResult command_result(CommandResult run) {
+  std::string result = std::move(run.output);
+  while (!result.empty() && (result.back() == '\n' || result.back() == '\r'))
     result.pop_back();
-  }
+  if (result.empty())
+    result = "(empty)";
+  if (run.status != 0)
+    return std::unexpected(
+        std::format("{}\n(exit status {})", result, run.status));
   return result;
 }
 
+ToolResult execute_bash(const boost::json::object &args) {
+  std::string cmd = get_string(args, "cmd");
+
+  auto run = run_command(cmd, "  \033[2m│ ");
+  if (!run)
+    return std::unexpected("error: popen failed");
+  return command_result(std::move(*run));
+}
+
 ToolResult execute_fetch_url(const boost::json::object &args) {
   std::string url = get_string(args, "url");
   std::string cmd = "curl -sL '" + url + "'";
@@ -346,36 +1061,21 @@ ToolResult execute_python(const boost::json::object &args) {
   out_file << code;
   out_file.close();
 
-  std::string cmd = "python3 .tmp_nano_script.py 2>&1";
-  FILE *fp = popen(cmd.c_str(), "r");
-  if (!fp)
-    return std::unexpected("error: popen failed to run python3");
-
-  std::stringstream out;
-  char buffer[1024];
-  while (fgets(buffer, sizeof(buffer), fp) != nullptr) {
-    std::string line(buffer);
-    std::cout << "  \033[2m"
-              << "│ py: " << line << "\033[0m" << std::flush;
-    out << line;
-  }
-  pclose(fp);
+  auto run = run_command("python3 .tmp_nano_script.py", "  \033[2m│ py: ");
   std::error_code ec;
   fs::remove(".tmp_nano_script.py", ec);
-
-  std::string result = out.str();
-  if (result.empty())
-    return "(empty)";
-  while (!result.empty() && (result.back() == '\n' || result.back() == '\r'))
-    result.pop_back();
-  return result;
+  if (!run)
+    return std::unexpected("error: popen failed to run python3");
+  return command_result(std::move(*run));
 }
 
 boost::json::array get_tools_schema() {
   return {
       {{"name", "read"},
        {"description",
-        "Read file with line numbers (file path, not directory)"},
+        "Read file with line numbers (file path, not directory). A "
+        "negative offset counts lines from the end; very long lines are "
+        "truncated"},
        {"input_schema",
         {{"type", "object"},
          {"properties",
@@ -383,6 +1083,25 @@ boost::json::array get_tools_schema() {
            {"offset", {{"type", "integer"}}},
            {"limit", {{"type", "integer"}}}}},
          {"required", {"path"}}}}},
+      {{"name", "read_many"},
+       {"description",
+        "Read several files in one call, each under a ==> path <== header. "
+        "Entries take the same offset/limit as read; output stops at "
+        "max_bytes (default 100KB)"},
+       {"input_schema",
+        {{"type", "object"},
+         {"properties",
+          {{"files",
+            {{"type", "array"},
+             {"items",
+              {{"type", "object"},
+               {"properties",
+                {{"path", {{"type", "string"}}},
+                 {"offset", {{"type", "integer"}}},
+                 {"limit", {{"type", "integer"}}}}},
+               {"required", {"path"}}}}}},
+           {"max_bytes", {{"type", "integer"}}}}},
+         {"required", {"files"}}}}},
       {{"name", "write"},
        {"description", "Write content to file"},
        {"input_schema",
@@ -390,9 +1109,32 @@ boost::json::array get_tools_schema() {
          {"properties",
           {{"path", {{"type", "string"}}}, {"content", {{"type", "string"}}}}},
          {"required", {"path", "content"}}}}},
+      {{"name", "write_many"},
+       {"description",
+        "Write several files in one call, in parallel. Each file is replaced "
+        "atomically (temp file + rename) and reported separately; if any "
+        "fails the call is an error, but the others stay written. Missing "
+        "directories are created unless create_dirs=false. sync=true also "
+        "flushes them to disk"},
+       {"input_schema",
+        {{"type", "object"},
+         {"properties",
+          {{"files",
+            {{"type", "array"},
+             {"items",
+              {{"type", "object"},
+               {"properties",
+                {{"path", {{"type", "string"}}},
+                 {"content", {{"type", "string"}}}}},
+               {"required", {"path", "content"}}}}}},
+           {"sync", {{"type", "boolean"}}},
+           {"create_dirs", {{"type", "boolean"}}}}},
+         {"required", {"files"}}}}},
       {{"name", "edit"},
        {"description",
-        "Replace old with new in file (old must be unique unless all=true)"},
+        "Replace old with new in file (old must be unique unless all=true). "
+        "If old is not found exactly, lines are matched ignoring trailing "
+        "whitespace and line endings, then ignoring indentation"},
        {"input_schema",
         {{"type", "object"},
          {"properties",
@@ -401,6 +1143,37 @@ boost::json::array get_tools_schema() {
            {"new", {{"type", "string"}}},
            {"all", {{"type", "boolean"}}}}},
          {"required", {"path", "old", "new"}}}}},
+      {{"name", "multi_edit"},
+       {"description",
+        "Apply several old/new replacements to one file at once. Each old is "
+        "matched against the original file, as edit matches it, and must be "
+        "unique unless all=true; matches may not overlap. Nothing is written "
+        "if any edit fails"},
+       {"input_schema",
+        {{"type", "object"},
+         {"properties",
+          {{"path", {{"type", "string"}}},
+           {"edits",
+            {{"type", "array"},
+             {"items",
+              {{"type", "object"},
+               {"properties",
+                {{"old", {{"type", "string"}}},
+                 {"new", {{"type", "string"}}},
+                 {"all", {{"type", "boolean"}}}}},
+               {"required", {"old", "new"}}}}}}}},
+         {"required", {"path", "edits"}}}}},
+      {{"name", "apply_patch"},
+       {"description",
+        "Apply a unified diff (---/+++ headers, @@ hunks) to one or more "
+        "files; /dev/null creates or deletes a file. Hunks are placed near "
+        "their line numbers, tolerating drift, trailing whitespace and some "
+        "stale context. All files change or none do; rejected hunks are "
+        "reported with the closest mismatch"},
+       {"input_schema",
+        {{"type", "object"},
+         {"properties", {{"patch", {{"type", "string"}}}}},
+         {"required", {"patch"}}}}},
       {{"name", "glob"},
        {"description", "Find files by pattern, sorted by mtime"},
        {"input_schema",
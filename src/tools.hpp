@@ -2,7 +2,9 @@
 
 #include <boost/json.hpp>
 #include <expected>
+#include <filesystem>
 #include <string>
+#include <string_view>
 
 namespace tools {
 
@@ -11,9 +13,23 @@ namespace tools {
 // or an error string if something went wrong.
 using ToolResult = std::expected<std::string, std::string>;
 
+// Directory in the workspace root where nanocode keeps its own files
+// (checkpoints, caches). glob and grep do not descend into it.
+inline constexpr std::string_view state_dir_name = ".nanocode";
+
+// Creates `dir` and any missing parents. A state directory among them is
+// given a .gitignore that keeps its contents out of `git status` and
+// commits. Callers create their directories only once they save a file, so
+// a session that saves nothing leaves no trace in the workspace.
+void create_state_dir(const std::filesystem::path &dir);
+
 ToolResult execute_read(const boost::json::object &args);
+ToolResult execute_read_many(const boost::json::object &args);
 ToolResult execute_write(const boost::json::object &args);
+ToolResult execute_write_many(const boost::json::object &args);
 ToolResult execute_edit(const boost::json::object &args);
+ToolResult execute_multi_edit(const boost::json::object &args);
+ToolResult execute_apply_patch(const boost::json::object &args);
 ToolResult execute_glob(const boost::json::object &args);
 ToolResult execute_grep(const boost::json::object &args);
 ToolResult execute_bash(const boost::json::object &args);
@@ -0,0 +1,125 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <boost/json.hpp>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+struct Event {
+  std::string name;
+  Track track;
+  long long ts_us;
+  long long dur_us;
+};
+
+struct Recorder {
+  std::mutex mutex;
+  std::atomic<bool> enabled{false};
+  std::string path;
+  std::chrono::steady_clock::time_point origin;
+  std::vector<Event> events;
+};
+
+Recorder &recorder() {
+  static Recorder instance;
+  return instance;
+}
+
+long long micros(std::chrono::steady_clock::duration d) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+}
+
+const char *track_name(Track track) {
+  switch (track) {
+  case Track::agent:
+    return "agent";
+  case Track::network:
+    return "network";
+  case Track::tools:
+    return "tools";
+  case Track::output:
+    return "output";
+  }
+  return "other";
+}
+
+} // namespace
+
+void start(std::string path) {
+  auto &r = recorder();
+  std::lock_guard lock(r.mutex);
+  r.path = std::move(path);
+  r.origin = std::chrono::steady_clock::now();
+  r.events.clear();
+  r.enabled = true;
+}
+
+bool enabled() { return recorder().enabled; }
+
+void finish() {
+  auto &r = recorder();
+  std::lock_guard lock(r.mutex);
+  if (!r.enabled)
+    return;
+  r.enabled = false;
+
+  boost::json::array events;
+  events.reserve(r.events.size() + 4);
+  int pid = static_cast<int>(::getpid());
+  for (Track track :
+       {Track::agent, Track::network, Track::tools, Track::output}) {
+    events.push_back({{"name", "thread_name"},
+                      {"ph", "M"},
+                      {"pid", pid},
+                      {"tid", static_cast<int>(track)},
+                      {"args", {{"name", track_name(track)}}}});
+  }
+  for (const auto &e : r.events) {
+    events.push_back({{"name", e.name},
+                      {"cat", track_name(e.track)},
+                      {"ph", "X"},
+                      {"pid", pid},
+                      {"tid", static_cast<int>(e.track)},
+                      {"ts", e.ts_us},
+                      {"dur", e.dur_us}});
+  }
+  r.events.clear();
+
+  std::ofstream out(r.path);
+  if (!out) {
+    std::cerr << "Failed to write trace to " << r.path << "\n";
+    return;
+  }
+  out << boost::json::serialize(boost::json::object{
+      {"traceEvents", std::move(events)}, {"displayTimeUnit", "ms"}});
+}
+
+Span::Span(std::string_view name, Track track)
+    : active_(enabled()), track_(track) {
+  if (active_) {
+    name_ = name;
+    start_ = std::chrono::steady_clock::now();
+  }
+}
+
+void Span::end() {
+  if (!active_)
+    return;
+  active_ = false;
+  auto now = std::chrono::steady_clock::now();
+  auto &r = recorder();
+  std::lock_guard lock(r.mutex);
+  if (!r.enabled)
+    return;
+  r.events.push_back({std::move(name_), track_, micros(start_ - r.origin),
+                      micros(now - start_)});
+}
+
+} // namespace trace
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace trace {
+
+// Tracks (Chrome trace "threads") that spans are grouped under, one per kind
+// of task so concurrent work appears side by side in Perfetto.
+enum class Track : int {
+  agent = 1,
+  network = 2,
+  tools = 3,
+  output = 4,
+};
+
+// Starts recording spans; they are written to `path` by `finish()`.
+void start(std::string path);
+
+bool enabled();
+
+// Writes the recorded spans as a Chrome Trace Event JSON file.
+void finish();
+
+// RAII complete-event ("ph": "X"). A no-op when tracing is disabled.
+class Span {
+public:
+  Span(std::string_view name, Track track);
+  ~Span() { end(); }
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+  // Ends the span early, e.g. before a co_await that belongs to a later
+  // phase.
+  void end();
+
+private:
+  bool active_;
+  Track track_;
+  std::string name_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace trace